@@ -0,0 +1,7 @@
+#include "activation.h"
+#include "kernels.h"
+
+void activate(activation f, float* values, size_t count)
+{
+	kernels().activate(f, values, count);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Activation functions of the network layers.
+// The values are stored in model files, so new functions go at the end.
+enum class activation
+{
+	linear, sigmoid, relu, tanh, softmax
+};
+
+// Whether a value read from a model file is one of the functions
+inline bool is_activation(int32_t value)
+{
+	return value >= (int32_t)activation::linear && value <= (int32_t)activation::softmax;
+}
+
+// Applies the activation function to count values in place.
+// Softmax normalizes the count values as one vector, so it has to be called for every row separately.
+void activate(activation f, float* values, size_t count);
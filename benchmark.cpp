@@ -0,0 +1,991 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+
+#include "neural_net.h"
+#include "auxiliary.h"
+#include "thread_pool.h"
+#include "kernels.h"
+#include "data_parallel_trainer.h"
+#include "pipeline_trainer.h"
+#include "inference_server.h"
+#include "inference_session.h"
+#include "mnist.h"
+#include "byte_matrix.h"
+#include "idx_stream.h"
+#include "matrix_allocator.h"
+#include "quantized_net.h"
+#include "static_neural_net.h"
+#include "profiler.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Returns the average time of one call to f in seconds
+template<typename F>
+double measure(F&& f, double min_time = 0.2)
+{
+	f(); // Warm up caches and the thread pool
+
+	int iterations = 0;
+	double elapsed = 0;
+	const auto start = std::chrono::steady_clock::now();
+	do
+	{
+		f();
+		iterations++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < min_time);
+
+	return elapsed / iterations;
+}
+
+matrix random_matrix(int width, int height)
+{
+	matrix result(width, height);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+		result.at(i) = random_float(-1.f, 1.f);
+	return result;
+}
+
+void benchmark_thread_scaling()
+{
+	// Layer shapes of the network trained in digits()
+	const int input_size = 784;
+	const int hidden_size = 80;
+	const int output_size = 10;
+	const int batch_sizes[] = { 64, 256, 1024 };
+	const int thread_counts[] = { 1, 2, 4, 8, 16 };
+
+	const int layer_sizes[] = { input_size, hidden_size, output_size };
+	neural_net net(3, layer_sizes);
+
+	struct result
+	{
+		const char* name;
+		int batch;
+		double time[std::size(thread_counts)];
+	};
+	std::vector<result> results;
+
+	for (int batch : batch_sizes)
+	{
+		const matrix input = random_matrix(input_size, batch);
+		const matrix hidden = random_matrix(hidden_size, batch);
+		const matrix weights = random_matrix(hidden_size, input_size);
+		const matrix required_output(output_size, batch, 0.f);
+
+		result forward = { "forward gemm", batch, {} };
+		result gradient = { "gradient gemm", batch, {} };
+		result transposition = { "transpose", batch, {} };
+		result elementwise = { "elementwise", batch, {} };
+		result train_step = { "train_batch step", batch, {} };
+
+		for (size_t t = 0; t < std::size(thread_counts); t++)
+		{
+			thread_pool::instance().set_num_threads(thread_counts[t]);
+
+			forward.time[t] = measure([&] { matrix r = input * weights; });
+			const matrix input_t = transpose(input);
+			gradient.time[t] = measure([&] { matrix r = input_t * hidden; });
+			transposition.time[t] = measure([&] { matrix r = transpose(input); });
+			elementwise.time[t] = measure([&] { matrix r = input * 0.5f + input; });
+			train_step.time[t] = measure([&] { net.train_batch(input, required_output, 1, 0.001f); });
+		}
+
+		results.push_back(forward);
+		results.push_back(gradient);
+		results.push_back(transposition);
+		results.push_back(elementwise);
+		results.push_back(train_step);
+	}
+
+	std::cout << "Thread scaling (hardware threads: " << std::thread::hardware_concurrency() << ")\n";
+	std::cout << std::left << std::setw(18) << "operation" << std::setw(7) << "batch";
+	for (int threads : thread_counts)
+		std::cout << std::right << std::setw(14) << (std::to_string(threads) + " thr");
+	std::cout << '\n';
+
+	for (const result& r : results)
+	{
+		std::cout << std::left << std::setw(18) << r.name << std::setw(7) << r.batch;
+		for (size_t t = 0; t < std::size(thread_counts); t++)
+		{
+			std::cout << std::right << std::setw(8) << std::fixed << std::setprecision(3) << r.time[t] * 1e3 << "ms "
+				<< std::setw(4) << std::setprecision(1) << r.time[0] / r.time[t] << 'x';
+		}
+		std::cout << '\n';
+	}
+}
+
+void benchmark_data_parallel()
+{
+	const int layer_sizes[] = { 784, 80, 10 };
+	const int batch_sizes[] = { 256, 1024, 4096 };
+	const int thread_counts[] = { 1, 2, 4, 8, 16 };
+
+	neural_net net(3, layer_sizes);
+
+	std::cout << "Data-parallel training, samples/sec (hardware threads: " << std::thread::hardware_concurrency() << ")\n";
+	std::cout << std::left << std::setw(7) << "batch" << std::right << std::setw(12) << "serial";
+	for (int threads : thread_counts)
+		std::cout << std::setw(18) << (std::to_string(threads) + " thr");
+	std::cout << '\n';
+
+	for (int batch : batch_sizes)
+	{
+		const matrix input = random_matrix(layer_sizes[0], batch);
+		const matrix required_output(layer_sizes[2], batch, 0.f);
+
+		thread_pool::instance().set_num_threads(1);
+		neural_net::training_workspace ws(net, batch);
+		const double serial_time = measure([&] { net.train_batch(input, required_output, 1, 0.001f, ws); });
+
+		std::cout << std::left << std::setw(7) << batch << std::right << std::setw(12) << std::fixed << std::setprecision(0) << batch / serial_time;
+
+		for (int threads : thread_counts)
+		{
+			thread_pool::instance().set_num_threads(threads);
+			data_parallel_trainer trainer(net, batch);
+			const double time = measure([&] { trainer.step(input, required_output, 0.001f); });
+
+			std::cout << std::setw(12) << std::setprecision(0) << batch / time
+				<< std::setw(5) << std::setprecision(1) << serial_time / time << 'x';
+		}
+		std::cout << '\n';
+	}
+}
+
+void benchmark_pipeline()
+{
+	// Deep and narrow, where data parallelism runs out of batch
+	const int num_layers = 14;
+	const int batch = 256;
+	const int num_micro_batches = 8;
+	const int stage_counts[] = { 1, 2, 4, 8 };
+
+	std::vector<int> layer_sizes(num_layers, 64);
+	layer_sizes.front() = 128;
+	layer_sizes.back() = 10;
+	std::vector<activation> activations(num_layers - 1, activation::relu);
+	activations.back() = activation::sigmoid;
+
+	neural_net net(num_layers, layer_sizes.data(), activations.data());
+
+	const matrix input = random_matrix(layer_sizes.front(), batch);
+	const matrix required_output(layer_sizes.back(), batch, 0.f);
+
+	neural_net::training_workspace ws(net, batch);
+	const double serial_time = measure([&] { net.train_batch(input, required_output, 1, 0.001f, ws); });
+
+	std::cout << "Pipeline-parallel training of " << num_layers << " layers, batch " << batch << " in " << num_micro_batches
+		<< " micro-batches (hardware threads: " << std::thread::hardware_concurrency() << ")\n";
+	std::cout << std::left << std::setw(10) << "serial" << std::right << std::setw(12) << std::fixed << std::setprecision(0) << batch / serial_time << " samples/sec\n";
+
+	for (int stages : stage_counts)
+	{
+		pipeline_trainer trainer(net, stages, batch, num_micro_batches);
+		const double time = measure([&] { trainer.step(input, required_output, 0.001f); });
+
+		std::cout << std::left << std::setw(10) << (std::to_string(stages) + " stg") << std::right << std::setw(12) << std::setprecision(0) << batch / time
+			<< " samples/sec " << std::setw(5) << std::setprecision(2) << serial_time / time << "x\n";
+	}
+}
+
+// Closed-loop load generator: num_clients threads call request(client) back to back for duration seconds.
+// Prints the throughput and the p50/p99 latency of the calls.
+template<typename F>
+void generate_load(const char* name, int num_clients, double duration, F&& request)
+{
+	std::vector<std::vector<double>> latencies(num_clients);
+	std::atomic<bool> stop{ false };
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> clients;
+	for (int c = 0; c < num_clients; c++)
+	{
+		clients.emplace_back([&, c]
+		{
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				const auto begin = std::chrono::steady_clock::now();
+				request(c);
+				latencies[c].push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+			}
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+	stop = true;
+	for (std::thread& t : clients)
+		t.join();
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<double> all;
+	for (const std::vector<double>& l : latencies)
+		all.insert(all.end(), l.begin(), l.end());
+	std::sort(all.begin(), all.end());
+
+	std::cout << std::left << std::setw(10) << name << std::right << std::setw(8) << num_clients
+		<< std::setw(14) << std::fixed << std::setprecision(0) << all.size() / elapsed
+		<< std::setw(12) << std::setprecision(1) << all[(all.size() - 1) / 2] * 1e6
+		<< std::setw(12) << all[(all.size() - 1) * 99 / 100] * 1e6;
+}
+
+void benchmark_server()
+{
+	const int layer_sizes[] = { 784, 80, 10 };
+	const int client_counts[] = { 1, 4, 16, 64 };
+	const double duration = 0.5;
+
+	const neural_net net(3, layer_sizes);
+	const matrix samples = random_matrix(layer_sizes[0], 256);
+
+	std::cout << "Inference serving, 784-80-10 (hardware threads: " << std::thread::hardware_concurrency() << ")\n";
+	std::cout << std::left << std::setw(10) << "mode" << std::right << std::setw(8) << "clients" << std::setw(14) << "requests/s"
+		<< std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "mean batch" << '\n';
+
+	for (int clients : client_counts)
+	{
+		// Every client calls run() with its own one-row matrix
+		generate_load("direct", clients, duration, [&](int c)
+		{
+			const int sample = c % samples.get_height();
+			matrix output = net.run(samples.submatrix(sample, sample + 1));
+		});
+		std::cout << '\n';
+
+		// Every client owns a session and runs its sample without allocating
+		std::vector<inference_session> sessions(clients, inference_session(net, 1));
+		generate_load("session", clients, duration, [&](int c)
+		{
+			const int sample = c % samples.get_height();
+			float output[10];
+			sessions[c].run(samples.get_data() + (size_t)sample * samples.get_width(), output, 1);
+		});
+		std::cout << '\n';
+
+		inference_server server(net, 64, std::chrono::microseconds(200));
+		generate_load("batched", clients, duration, [&](int c)
+		{
+			const int sample = c % samples.get_height();
+			std::vector<float> output = server.submit(samples.get_data() + (size_t)sample * samples.get_width()).get();
+		});
+		std::cout << std::setw(12) << std::setprecision(1) << server.get_statistics().mean_batch_size << '\n';
+	}
+}
+
+void benchmark_latency()
+{
+	const int layer_sizes[] = { 784, 80, 10 };
+	const neural_net net(3, layer_sizes);
+	const matrix input = random_matrix(layer_sizes[0], 1);
+
+	inference_session session(net, 1);
+	const auto static_net = std::make_unique<static_neural_net<784, static_layer<80, activation::sigmoid>, static_layer<10, activation::sigmoid>>>(net);
+	float output[10];
+
+	const double run_time = measure([&] { matrix r = net.run(input); });
+	const double session_time = measure([&] { session.run(input.get_data(), output, 1); });
+	const double static_time = measure([&] { static_net->run(input.get_data(), output); });
+
+	std::cout << "Single-sample 784-80-10 forward pass (" << get_instruction_set_name(kernels().isa) << ")\n";
+	std::cout << std::left << std::setw(20) << "run()" << std::right << std::setw(10) << std::fixed << std::setprecision(2) << run_time * 1e6 << " us\n";
+	std::cout << std::left << std::setw(20) << "inference_session" << std::right << std::setw(10) << session_time * 1e6 << " us\n";
+	std::cout << std::left << std::setw(20) << "static_neural_net" << std::right << std::setw(10) << static_time * 1e6 << " us\n";
+}
+
+// Training steps on the same images kept as floats and as bytes converted inside the first layer's GEMM
+void benchmark_byte_input()
+{
+	const int layer_sizes[] = { 784, 80, 10 };
+	const int num_samples = 60000;
+	const int batch = 256;
+
+	byte_matrix images(layer_sizes[0], num_samples, mnist_pixel_scale);
+	for (int i = 0; i < num_samples; i++)
+	{
+		for (int j = 0; j < layer_sizes[0]; j++)
+			images.at(i, j) = (uint8_t)random_int(0, 255);
+	}
+	const matrix float_images = dequantize(images);
+	const matrix required_output(layer_sizes[2], num_samples, 0.f);
+
+	neural_net net(3, layer_sizes);
+	neural_net::training_workspace ws(net, batch);
+
+	// Every step takes the next batch, so the dataset is streamed from memory as in an epoch
+	int row = 0;
+	auto next_row = [&]
+	{
+		const int result = row;
+		row = row + 2 * batch <= num_samples ? row + batch : 0;
+		return result;
+	};
+
+	const double float_time = measure([&]
+	{
+		const int r = next_row();
+		net.train_batch(float_images.rows(r, r + batch), required_output.rows(r, r + batch), 1, 0.001f, ws);
+	});
+	const double byte_time = measure([&]
+	{
+		const int r = next_row();
+		net.train_batch(images.rows(r, r + batch), required_output.rows(r, r + batch), 1, 0.001f, ws);
+	});
+
+	std::cout << "784-80-10 training step, batch " << batch << ", " << num_samples << " samples\n";
+	std::cout << std::left << std::setw(10) << "input" << std::right << std::setw(14) << "dataset MB" << std::setw(12) << "step ms" << '\n';
+	std::cout << std::left << std::setw(10) << "float" << std::right << std::setw(14) << std::fixed << std::setprecision(1)
+		<< (double)num_samples * layer_sizes[0] * sizeof(float) / (1 << 20) << std::setw(12) << std::setprecision(3) << float_time * 1e3 << '\n';
+	std::cout << std::left << std::setw(10) << "uint8" << std::right << std::setw(14) << std::setprecision(1)
+		<< (double)num_samples * layer_sizes[0] / (1 << 20) << std::setw(12) << std::setprecision(3) << byte_time * 1e3 << '\n';
+}
+
+// Fraction of wrongly classified samples
+float classification_error(const matrix& output, const matrix& required_output)
+{
+	int errors = 0;
+	for (int j = 0; j < output.get_height(); j++)
+	{
+		int top = 0;
+		int required_top = 0;
+		for (int k = 1; k < output.get_width(); k++)
+		{
+			if (output.at(j, top) < output.at(j, k)) top = k;
+			if (required_output.at(j, required_top) < required_output.at(j, k)) required_top = k;
+		}
+		if (top != required_top)
+			errors++;
+	}
+	return (float)errors / output.get_height();
+}
+
+// MNIST from the working directory, or sparse synthetic images labeled by a random linear model if it is missing
+void load_digits(matrix& train_input, matrix& train_required_output, matrix& test_input, matrix& test_required_output)
+{
+	const int test_samples_num = 1000;
+
+	mnist_data data;
+	if (load_mnist("train-images.idx3-ubyte", "train-labels.idx1-ubyte", data))
+	{
+		mnist_samples(data, 0, data.num_samples - test_samples_num, train_input, train_required_output);
+		mnist_samples(data, data.num_samples - test_samples_num, test_samples_num, test_input, test_required_output);
+		return;
+	}
+
+	std::cout << "Using synthetic data\n";
+
+	const int input_size = 784;
+	const int train_samples_num = 20000;
+	const matrix teacher = random_matrix(mnist_num_classes, input_size);
+
+	auto generate = [&](int num_samples, matrix& input, matrix& required_output)
+	{
+		input = matrix(input_size, num_samples, 0.f);
+		for (size_t i = 0; i < (size_t)input_size * num_samples; i++)
+		{
+			if (random_int(0, 4) == 0) input.at(i) = random_float(0.f, 1.f);
+		}
+
+		const matrix scores = input * teacher;
+		required_output = matrix(mnist_num_classes, num_samples, 0.f);
+		for (int j = 0; j < num_samples; j++)
+		{
+			int top = 0;
+			for (int k = 1; k < mnist_num_classes; k++)
+			{
+				if (scores.at(j, top) < scores.at(j, k)) top = k;
+			}
+			required_output.at(j, top) = 1.f;
+		}
+	};
+
+	generate(train_samples_num, train_input, train_required_output);
+	generate(test_samples_num, test_input, test_required_output);
+}
+
+void benchmark_hogwild()
+{
+	matrix train_input, train_required_output, test_input, test_required_output;
+	load_digits(train_input, train_required_output, test_input, test_required_output);
+
+	const int layer_sizes[] = { train_input.get_width(), 80, mnist_num_classes };
+	const int thread_counts[] = { 1, 2, 4, 8, 16 };
+	const int samples_per_round = 20000;
+	const int num_rounds = 10;
+	const float rate = 0.05f;
+
+	// Both runs start from the same weights
+	const neural_net initial(3, layer_sizes);
+
+	thread_pool::instance().set_num_threads(1);
+
+	std::cout << "Throughput, samples/sec (hardware threads: " << std::thread::hardware_concurrency() << ")\n";
+	{
+		neural_net net = initial;
+		neural_net::training_workspace ws(net, 1);
+		const double time = measure([&] { net.train_stochastic(train_input, train_required_output, 1000, rate, ws); });
+		std::cout << std::left << std::setw(24) << "train_stochastic" << std::right << std::setw(12) << std::fixed << std::setprecision(0) << 1000 / time << '\n';
+	}
+	for (int threads : thread_counts)
+	{
+		neural_net net = initial;
+		const int samples = 1000 * threads;
+		const double time = measure([&] { net.train_hogwild(train_input, train_required_output, samples, rate, threads); });
+		std::cout << std::left << std::setw(24) << ("hogwild " + std::to_string(threads) + " thr") << std::right << std::setw(12) << samples / time << '\n';
+	}
+
+	const int hogwild_threads = std::max((int)std::thread::hardware_concurrency(), 2);
+
+	std::cout << "\nTest error by samples seen\n";
+	std::cout << std::left << std::setw(10) << "samples" << std::right << std::setw(18) << "train_stochastic"
+		<< std::setw(18) << ("hogwild " + std::to_string(hogwild_threads) + " thr") << '\n';
+
+	neural_net serial = initial;
+	neural_net hogwild = initial;
+	neural_net::training_workspace ws(serial, 1);
+
+	for (int round = 1; round <= num_rounds; round++)
+	{
+		serial.train_stochastic(train_input, train_required_output, samples_per_round, rate, ws);
+		hogwild.train_hogwild(train_input, train_required_output, samples_per_round, rate, hogwild_threads);
+
+		std::cout << std::left << std::setw(10) << round * samples_per_round << std::right << std::setprecision(4)
+			<< std::setw(18) << classification_error(serial.run(test_input), test_required_output)
+			<< std::setw(18) << classification_error(hogwild.run(test_input), test_required_output) << '\n';
+	}
+}
+
+// Training steps of the allocating train_batch, whose temporaries come from the heap, the pool or an arena
+void benchmark_allocator()
+{
+	const int layer_sizes[] = { 784, 256, 10 };
+	const int batch = 64;
+
+	neural_net net(3, layer_sizes);
+	const matrix input = random_matrix(layer_sizes[0], batch);
+	const matrix required_output(layer_sizes[2], batch, 0.f);
+	matrix_arena arena;
+
+	std::cout << "784-256-10 training step with temporaries, batch " << batch << '\n';
+	std::cout << std::left << std::setw(10) << "allocator" << std::right << std::setw(12) << "step us" << std::setw(16) << "heap allocs"
+		<< std::setw(12) << "pool hit %" << '\n';
+
+	for (const char* name : { "heap", "pool", "arena" })
+	{
+		reset_allocation_statistics();
+		size_t steps = 0;
+
+		const double time = measure([&]
+		{
+			{
+				allocator_scope scope(strcmp(name, "heap") == 0 ? matrix_allocator::get_heap() :
+					strcmp(name, "pool") == 0 ? (matrix_allocator&)matrix_allocator::get_pool() : (matrix_allocator&)arena);
+				net.train_batch(input, required_output, 1, 0.001f);
+			}
+			arena.reset();
+			steps++;
+		});
+
+		const allocation_statistics stats = get_allocation_statistics();
+		std::cout << std::left << std::setw(10) << name << std::right << std::setw(12) << std::fixed << std::setprecision(1) << time * 1e6
+			<< std::setw(16) << std::setprecision(2) << (double)stats.heap_allocations / steps
+			<< std::setw(12);
+		if (stats.pool_hits + stats.pool_misses)
+			std::cout << std::setprecision(1) << stats.get_pool_hit_rate() * 100 << '\n';
+		else
+			std::cout << "-" << '\n';
+	}
+}
+
+// Peak resident memory of the process in MB, 0 where it isn't available
+double peak_rss_mb()
+{
+#ifdef _WIN32
+	return 0;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.;
+#endif
+}
+
+static void write_big_endian(std::ofstream& f, uint32_t value)
+{
+	const unsigned char bytes[4] = { (unsigned char)(value >> 24), (unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value };
+	f.write(reinterpret_cast<const char*>(bytes), 4);
+}
+
+// One epoch over an IDX file read in chunks, then over the same file read whole, which is the in-memory path.
+// The streaming run goes first, so the peak resident memory after it is its own.
+void benchmark_streaming()
+{
+	const int layer_sizes[] = { 784, 80, 10 };
+	const int num_samples = 100000;
+	const int chunk_samples = 4096;
+	const int batch = 64;
+	const char* images_file_name = "benchmark-images.idx3-ubyte";
+	const char* labels_file_name = "benchmark-labels.idx1-ubyte";
+
+	{
+		std::ofstream images(images_file_name, std::ios::binary | std::ios::trunc);
+		std::ofstream labels(labels_file_name, std::ios::binary | std::ios::trunc);
+		write_big_endian(images, 0x00000803);
+		write_big_endian(images, num_samples);
+		write_big_endian(images, 28);
+		write_big_endian(images, 28);
+		write_big_endian(labels, 0x00000801);
+		write_big_endian(labels, num_samples);
+
+		std::vector<char> sample(layer_sizes[0]);
+		for (int i = 0; i < num_samples; i++)
+		{
+			for (char& pixel : sample)
+				pixel = (char)random_int(0, 255);
+			images.write(sample.data(), sample.size());
+			labels.put((char)random_int(0, 9));
+		}
+	}
+
+	neural_net net(3, layer_sizes);
+	neural_net::training_workspace ws(net, batch);
+
+	std::cout << "One epoch of 784-80-10, batch " << batch << ", " << num_samples << " samples ("
+		<< std::fixed << std::setprecision(1) << (double)num_samples * layer_sizes[0] / (1 << 20) << " MB)\n";
+	std::cout << std::left << std::setw(12) << "chunk" << std::right << std::setw(14) << "samples/s" << std::setw(14) << "peak RSS MB" << '\n';
+
+	for (const int chunk : { chunk_samples, num_samples })
+	{
+		idx_stream stream;
+		if (!stream.open(images_file_name, labels_file_name, chunk))
+		{
+			std::cout << "ERROR: couldn't open the data\n";
+			return;
+		}
+
+		// Warms the page cache and the workspace
+		train_stream(net, stream, 1, batch, 0.001f, mnist_pixel_scale, ws);
+
+		const auto start = std::chrono::steady_clock::now();
+		train_stream(net, stream, 1, batch, 0.001f, mnist_pixel_scale, ws);
+		const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << std::left << std::setw(12) << (chunk == num_samples ? "whole file" : std::to_string(chunk)) << std::right
+			<< std::setw(14) << std::fixed << std::setprecision(0) << num_samples / time
+			<< std::setw(14) << std::setprecision(1) << peak_rss_mb() << '\n';
+	}
+
+	std::remove(images_file_name);
+	std::remove(labels_file_name);
+}
+
+// Accuracy and speed of int8 inference against float run(), on the MNIST test split if its files are present
+// and on the held out samples of load_digits otherwise
+void benchmark_quantized()
+{
+	matrix train_input, train_required_output, test_input, test_required_output;
+	load_digits(train_input, train_required_output, test_input, test_required_output);
+
+	mnist_data test_data;
+	if (load_mnist("t10k-images.idx3-ubyte", "t10k-labels.idx1-ubyte", test_data))
+		mnist_samples(test_data, 0, test_data.num_samples, test_input, test_required_output);
+
+	const int layer_sizes[] = { train_input.get_width(), 80, mnist_num_classes };
+	const activation activations[] = { activation::relu, activation::softmax };
+	const int batch = 100;
+
+	neural_net net(3, layer_sizes, activations);
+	neural_net::training_workspace ws(net, batch);
+	net.train_mini_batch(train_input, train_required_output, batch, 3 * train_input.get_height() / batch, 0.02f, ws);
+
+	// Calibrated on training samples, never on the test set
+	const matrix_view calibration_input = train_input.rows(0, 1000);
+	const quantized_net per_layer(net, calibration_input, quantization_granularity::per_layer);
+	const quantized_net per_channel(net, calibration_input, quantization_granularity::per_channel);
+
+	size_t float_parameters_size = 0;
+	for (int i = 0; i < net.get_num_layers(); i++)
+		float_parameters_size += ((size_t)net.get_weights(i).get_width() * net.get_weights(i).get_height() + net.get_biases(i).get_width()) * sizeof(float);
+
+	thread_pool::instance().set_num_threads(1);
+
+	const matrix single(test_input.rows(0, 1));
+	const float float_error = classification_error(net.run(test_input), test_required_output);
+	const double float_single_time = measure([&] { matrix r = net.run(single); });
+	const double float_batch_time = measure([&] { matrix r = net.run(test_input); });
+
+	std::cout << "784-80-10, " << test_input.get_height() << " test samples, 1 thread (" << get_instruction_set_name(kernels().isa) << ")\n";
+	std::cout << std::left << std::setw(14) << "weights" << std::right << std::setw(10) << "error" << std::setw(12) << "params KB"
+		<< std::setw(12) << "1 row us" << std::setw(10) << "speedup" << std::setw(14) << "batch ms" << std::setw(10) << "speedup" << '\n';
+	std::cout << std::left << std::setw(14) << "float" << std::right << std::fixed << std::setprecision(4) << std::setw(10) << float_error
+		<< std::setprecision(1) << std::setw(12) << float_parameters_size / 1024.
+		<< std::setprecision(2) << std::setw(12) << float_single_time * 1e6 << std::setw(10) << 1.
+		<< std::setprecision(3) << std::setw(14) << float_batch_time * 1e3 << std::setprecision(2) << std::setw(10) << 1. << '\n';
+
+	for (const quantized_net* q : { &per_layer, &per_channel })
+	{
+		const float error = classification_error(q->run(test_input), test_required_output);
+		const double single_time = measure([&] { matrix r = q->run(single); });
+		const double batch_time = measure([&] { matrix r = q->run(test_input); });
+
+		std::cout << std::left << std::setw(14) << (q == &per_layer ? "int8 layer" : "int8 channel") << std::right << std::setprecision(4)
+			<< std::setw(10) << error << std::setprecision(1) << std::setw(12) << q->get_parameters_size() / 1024.
+			<< std::setprecision(2) << std::setw(12) << single_time * 1e6 << std::setw(10) << float_single_time / single_time
+			<< std::setprecision(3) << std::setw(14) << batch_time * 1e3 << std::setprecision(2) << std::setw(10) << float_batch_time / batch_time << '\n';
+	}
+}
+
+// Speed and accuracy of fp16 and bf16 weights against fp32 on a net too large for the cache, where a single row
+// is bound by reading the weights
+void benchmark_half_weights()
+{
+	const int layer_sizes[] = { 1024, 2048, 2048, 10 };
+	// A linear output shows the rounding error, which softmax would saturate away with untrained weights
+	const activation activations[] = { activation::relu, activation::relu, activation::linear };
+
+	const neural_net net(4, layer_sizes, activations);
+
+	matrix input(layer_sizes[0], 64);
+	for (size_t i = 0; i < (size_t)input.get_width() * input.get_height(); i++)
+		input.at(i) = random_float(0.f, 1.f);
+	const matrix single(input.rows(0, 1));
+	const matrix reference = net.run(input);
+	float max_reference = 0.f;
+	for (size_t i = 0; i < (size_t)reference.get_width() * reference.get_height(); i++)
+		max_reference = std::max(max_reference, std::fabs(reference.at(i)));
+
+	thread_pool::instance().set_num_threads(1);
+
+	double fp32_single_time = 0.;
+	std::cout << "1024-2048-2048-10, 1 thread (" << get_instruction_set_name(kernels().isa) << ")\n";
+	std::cout << std::left << std::setw(8) << "weights" << std::right << std::setw(12) << "file KB" << std::setw(14) << "rel diff"
+		<< std::setw(12) << "1 row us" << std::setw(10) << "speedup" << std::setw(14) << "64 rows ms" << '\n';
+
+	for (weight_precision precision : { weight_precision::fp32, weight_precision::fp16, weight_precision::bf16 })
+	{
+		neural_net converted = net;
+		converted.set_weight_precision(precision);
+
+		const char* const file_name = "half_weights_benchmark.bin";
+		converted.save_to_file(file_name);
+		const double file_size = (double)std::ifstream(file_name, std::ios::binary | std::ios::ate).tellg();
+		std::remove(file_name);
+
+		const matrix output = converted.run(input);
+		float max_diff = 0.f;
+		for (size_t i = 0; i < (size_t)output.get_width() * output.get_height(); i++)
+			max_diff = std::max(max_diff, std::fabs(output.at(i) - reference.at(i)));
+
+		const double single_time = measure([&] { matrix r = converted.run(single); });
+		const double batch_time = measure([&] { matrix r = converted.run(input); });
+		if (precision == weight_precision::fp32)
+			fp32_single_time = single_time;
+
+		const char* const names[] = { "fp32", "fp16", "bf16" };
+		std::cout << std::left << std::setw(8) << names[(int)precision] << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << file_size / 1024. << std::scientific << std::setprecision(2) << std::setw(14) << max_diff / max_reference << std::fixed
+			<< std::setw(12) << single_time * 1e6 << std::setw(10) << fp32_single_time / single_time
+			<< std::setprecision(3) << std::setw(14) << batch_time * 1e3 << '\n';
+	}
+}
+
+// Where the time of training steps goes, by operation and layer, and a trace of the last steps for a timeline viewer
+void benchmark_profile(const char* trace_file)
+{
+	const int layer_sizes[] = { 784, 80, 10 };
+	const activation activations[] = { activation::relu, activation::softmax };
+	const int batch = 256;
+
+	neural_net net(3, layer_sizes, activations);
+	neural_net::training_workspace ws(net, batch);
+	const matrix input = random_matrix(layer_sizes[0], batch);
+	const matrix required_output = random_matrix(layer_sizes[2], batch);
+
+	// Preallocated and allocating steps, then a forward pass
+	auto step = [&]
+	{
+		net.backpropagation(input, required_output, 0.001f, ws);
+		net.backpropagation(input, required_output, 0.001f);
+		matrix r = net.run(input);
+	};
+
+	step(); // Warm up caches and the thread pool
+
+	profiler& p = profiler::instance();
+	const bool was_enabled = profiler::is_enabled();
+	profiler::set_enabled(true);
+	p.reset();
+	for (int i = 0; i < 20; i++)
+		step();
+	profiler::set_enabled(was_enabled);
+
+	std::cout << "Profile of 20 training steps of 784-80-10, batch " << batch << " (" << get_instruction_set_name(kernels().isa) << ")\n";
+	std::cout << std::left << std::setw(32) << "operation" << std::right << std::setw(8) << "calls" << std::setw(12) << "total ms"
+		<< std::setw(12) << "us/call" << std::setw(10) << "GFLOPS" << std::setw(10) << "GB/s" << std::setw(10) << "allocs" << '\n';
+	for (const profiler::op_stats& s : p.get_stats())
+	{
+		const std::string name = s.layer >= 0 ? s.name + " layer " + std::to_string(s.layer) : s.name;
+		std::cout << std::left << std::setw(32) << name << std::right << std::setw(8) << s.calls << std::fixed << std::setprecision(3)
+			<< std::setw(12) << s.time * 1e3 << std::setprecision(1) << std::setw(12) << s.time / s.calls * 1e6 << std::setprecision(2)
+			<< std::setw(10) << s.flops / s.time * 1e-9 << std::setw(10) << s.bytes / s.time * 1e-9 << std::setw(10) << s.allocations << '\n';
+	}
+
+	if (p.write_chrome_trace(trace_file))
+		std::cout << "Trace written to " << trace_file << '\n';
+}
+
+// One measurement of the suite, the work it does per call gives the rates, zero where a rate doesn't apply
+struct suite_result
+{
+	std::string name;
+	double time; // Seconds per call
+	double flops;
+	double bytes; // Read and written
+	double samples;
+};
+
+static double get_rate(double amount, double time)
+{
+	return amount > 0. ? amount / time : 0.;
+}
+
+// Times per call of a previous run of the suite, read back from the JSON it wrote, one result per line
+static std::vector<std::pair<std::string, double>> read_suite_baseline(const char* file_name)
+{
+	std::vector<std::pair<std::string, double>> result;
+	std::ifstream f(file_name);
+	std::string line;
+	while (std::getline(f, line))
+	{
+		const size_t name = line.find("\"name\": \"");
+		const size_t time = line.find("\"ns_per_op\": ");
+		if (name == std::string::npos || time == std::string::npos) continue;
+
+		const size_t name_begin = name + 9;
+		const size_t name_end = line.find('"', name_begin);
+		result.emplace_back(line.substr(name_begin, name_end - name_begin), std::strtod(line.c_str() + time + 13, nullptr));
+	}
+	return result;
+}
+
+// Kernels, layers and training steps of the shapes the examples use, with their rates.
+// The results are written as JSON to json_file if it is given, and compared to the ones in baseline_file.
+void benchmark_suite(const char* json_file, const char* baseline_file)
+{
+	std::vector<suite_result> results;
+	auto add = [&](std::string name, double time, double flops, double bytes, double samples)
+	{
+		results.push_back({ std::move(name), time, flops, bytes, samples });
+	};
+
+	// GEMM over the shapes of the forward and backward passes of 784-80-10, then square ones
+	const int gemm_shapes[][3] = { { 64, 80, 784 }, { 256, 80, 784 }, { 1024, 80, 784 }, { 784, 80, 256 }, { 256, 784, 80 },
+		{ 256, 10, 80 }, { 128, 128, 128 }, { 512, 512, 512 }, { 1024, 1024, 1024 } };
+	for (const auto& shape : gemm_shapes)
+	{
+		const int m = shape[0], n = shape[1], k = shape[2];
+		const matrix a = random_matrix(k, m);
+		const matrix b = random_matrix(n, k);
+		matrix c(n, m);
+		add("gemm " + std::to_string(m) + "x" + std::to_string(n) + "x" + std::to_string(k), measure([&] { multiply(a, b, c); }),
+			2. * m * n * k, 4. * ((double)m * k + (double)k * n + (double)m * n), 0.);
+	}
+
+	const int width = 784;
+	const int height = 1024;
+	const double count = (double)width * height;
+	const matrix input = random_matrix(width, height);
+	matrix output(width, height);
+	matrix output_t(height, width);
+
+	add("transpose 1024x784", measure([&] { transpose(input, output_t); }), 0., 8. * count, 0.);
+	add("elementwise 1024x784", measure([&] { output = input * 0.5f + input; }), 2. * count, 8. * count, 0.);
+	add("activation_function 1024x784", measure([&] { neural_net::activation_function(input, output); }), 0., 8. * count, 0.);
+
+	const matrix logits = random_matrix(80, height);
+	matrix values(80, height);
+	const char* const activation_names[] = { "linear", "sigmoid", "relu", "tanh", "softmax" };
+	for (activation f : { activation::sigmoid, activation::relu, activation::tanh, activation::softmax })
+	{
+		const size_t size = (size_t)logits.get_width() * logits.get_height();
+		const double time = measure([&]
+		{
+			memcpy(values.get_data(), logits.get_data(), size * sizeof(float));
+			for (int i = 0; i < values.get_height(); i++)
+				activate(f, values.get_data() + (size_t)i * values.get_width(), values.get_width());
+		});
+		add(std::string("activate ") + activation_names[(int)f] + " 1024x80", time, 0., 8. * size, 0.);
+	}
+
+	// Forward passes and training steps of the network trained in digits()
+	const int layer_sizes[] = { 784, 80, 10 };
+	const activation activations[] = { activation::relu, activation::softmax };
+	const double flops_per_sample = 2. * (784 * 80 + 80 * 10);
+	neural_net net(3, layer_sizes, activations);
+
+	for (int batch : { 1, 16, 64, 256, 1024 })
+	{
+		const matrix_view batch_input = input.rows(0, batch);
+		add("run 784-80-10 batch " + std::to_string(batch), measure([&] { matrix r = net.run(batch_input); }),
+			flops_per_sample * batch, 0., batch);
+	}
+
+	const matrix required_output = random_matrix(10, height);
+	for (int batch : { 1, 64, 256 })
+	{
+		neural_net::training_workspace ws(net, batch);
+		const matrix_view batch_input = input.rows(0, batch);
+		const matrix_view batch_output = required_output.rows(0, batch);
+		// The forward pass, and two products of the same size for the weight and input gradients
+		add("backpropagation 784-80-10 batch " + std::to_string(batch),
+			measure([&] { net.backpropagation(batch_input, batch_output, 0.001f, ws); }), 3. * flops_per_sample * batch, 0., batch);
+	}
+
+	// Model files of about 24 MB
+	const int file_layer_sizes[] = { 1024, 2048, 2048, 10 };
+	neural_net file_net(4, file_layer_sizes);
+	const char* const file_name = "benchmark_suite_model.bin";
+	file_net.save_to_file(file_name);
+	const double file_size = (double)std::ifstream(file_name, std::ios::binary | std::ios::ate).tellg();
+	add("save_to_file 24MB", measure([&] { file_net.save_to_file(file_name); }), 0., file_size, 0.);
+	add("load_from_file 24MB", measure([&] { file_net.load_from_file(file_name); }), 0., file_size, 0.);
+	add("map_from_file 24MB", measure([&] { file_net.map_from_file(file_name); }), 0., 0., 0.);
+	file_net = neural_net(2, file_layer_sizes); // Unmaps the file
+	std::remove(file_name);
+
+	const std::vector<std::pair<std::string, double>> baseline = baseline_file ? read_suite_baseline(baseline_file) : std::vector<std::pair<std::string, double>>();
+	auto find_baseline = [&](const std::string& name)
+	{
+		for (const auto& b : baseline)
+		{
+			if (b.first == name) return b.second * 1e-9;
+		}
+		return 0.;
+	};
+
+	std::cout << "Benchmark suite (" << get_instruction_set_name(kernels().isa) << ", " << thread_pool::instance().get_num_threads() << " threads)\n";
+	std::cout << std::left << std::setw(36) << "benchmark" << std::right << std::setw(14) << "ns/op" << std::setw(10) << "GFLOPS"
+		<< std::setw(10) << "GB/s" << std::setw(14) << "samples/s";
+	if (baseline_file)
+		std::cout << std::setw(12) << "speedup";
+	std::cout << '\n';
+
+	for (const suite_result& r : results)
+	{
+		auto print_rate = [&](double amount, double unit, int width, int precision)
+		{
+			if (amount > 0.)
+				std::cout << std::setprecision(precision) << std::setw(width) << amount / r.time * unit;
+			else
+				std::cout << std::setw(width) << '-';
+		};
+
+		std::cout << std::left << std::setw(36) << r.name << std::right << std::fixed << std::setprecision(0) << std::setw(14) << r.time * 1e9;
+		print_rate(r.flops, 1e-9, 10, 2);
+		print_rate(r.bytes, 1e-9, 10, 2);
+		print_rate(r.samples, 1., 14, 0);
+		if (baseline_file)
+		{
+			const double baseline_time = find_baseline(r.name);
+			if (baseline_time > 0.)
+				std::cout << std::setprecision(2) << std::setw(11) << baseline_time / r.time << 'x';
+			else
+				std::cout << std::setw(12) << '-';
+		}
+		std::cout << '\n';
+	}
+
+	if (json_file)
+	{
+		std::ofstream f(json_file);
+		f << "{\n\t\"isa\": \"" << get_instruction_set_name(kernels().isa) << "\",\n\t\"threads\": " << thread_pool::instance().get_num_threads()
+			<< ",\n\t\"results\": [\n";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const suite_result& r = results[i];
+			f << "\t\t{ \"name\": \"" << r.name << "\", \"ns_per_op\": " << std::setprecision(6) << std::defaultfloat << r.time * 1e9
+				<< ", \"gflops\": " << get_rate(r.flops, r.time) * 1e-9 << ", \"gb_per_s\": " << get_rate(r.bytes, r.time) * 1e-9
+				<< ", \"samples_per_s\": " << get_rate(r.samples, r.time) << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		f << "\t]\n}\n";
+		std::cout << "Results written to " << json_file << '\n';
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* name = argc > 1 ? argv[1] : "threads";
+
+	if (strcmp(name, "threads") == 0)
+	{
+		benchmark_thread_scaling();
+	}
+	else if (strcmp(name, "data_parallel") == 0)
+	{
+		benchmark_data_parallel();
+	}
+	else if (strcmp(name, "hogwild") == 0)
+	{
+		benchmark_hogwild();
+	}
+	else if (strcmp(name, "pipeline") == 0)
+	{
+		benchmark_pipeline();
+	}
+	else if (strcmp(name, "server") == 0)
+	{
+		benchmark_server();
+	}
+	else if (strcmp(name, "latency") == 0)
+	{
+		benchmark_latency();
+	}
+	else if (strcmp(name, "byte_input") == 0)
+	{
+		benchmark_byte_input();
+	}
+	else if (strcmp(name, "streaming") == 0)
+	{
+		benchmark_streaming();
+	}
+	else if (strcmp(name, "allocator") == 0)
+	{
+		benchmark_allocator();
+	}
+	else if (strcmp(name, "quantized") == 0)
+	{
+		benchmark_quantized();
+	}
+	else if (strcmp(name, "half_weights") == 0)
+	{
+		benchmark_half_weights();
+	}
+	else if (strcmp(name, "profile") == 0)
+	{
+		benchmark_profile(argc > 2 ? argv[2] : "profile_trace.json");
+	}
+	else if (strcmp(name, "suite") == 0)
+	{
+		benchmark_suite(argc > 2 ? argv[2] : nullptr, argc > 3 ? argv[3] : nullptr);
+	}
+	else
+	{
+		std::cout << "Usage: benchmark [threads | data_parallel | hogwild | pipeline | server | latency | byte_input | streaming | allocator | quantized | half_weights]\n";
+		std::cout << "       benchmark suite [results.json [baseline.json]]\n";
+		std::cout << "       benchmark profile [trace.json]\n";
+		return 1;
+	}
+
+	return 0;
+}
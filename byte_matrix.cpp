@@ -0,0 +1,45 @@
+#include "byte_matrix.h"
+#include "gemm.h"
+
+#include <cmath>
+#include <algorithm>
+
+byte_matrix::byte_matrix(const matrix_view& m, float scale) : byte_matrix(m.get_width(), m.get_height(), scale)
+{
+	for (int i = 0; i < height; i++)
+	{
+		const float* row = m.row(i);
+		for (int j = 0; j < width; j++)
+			at(i, j) = (uint8_t)std::min(std::max(std::round(row[j] / scale), 0.f), 255.f);
+	}
+}
+
+void multiply(const byte_matrix_view& a, bool transpose_a, const matrix_view& b, bool transpose_b, matrix& result)
+{
+	assert(a.is_alive() && b.is_alive());
+	assert(result.get_data() != b.get_data());
+
+	const int m = transpose_a ? a.get_width() : a.get_height();
+	const int k = transpose_a ? a.get_height() : a.get_width();
+	const int n = transpose_b ? b.get_height() : b.get_width();
+	assert(k == (transpose_b ? b.get_width() : b.get_height()));
+
+	result.resize(n, m);
+
+	gemm(transpose_a, transpose_b, m, n, k,
+		a.get_data(), a.get_stride(), a.get_scale(), b.get_data(), b.get_stride(), result.get_data(), result.get_width());
+}
+
+matrix dequantize(const byte_matrix_view& m)
+{
+	assert(m.is_alive());
+
+	matrix result(m.get_width(), m.get_height());
+	for (int i = 0; i < m.get_height(); i++)
+	{
+		for (int j = 0; j < m.get_width(); j++)
+			result.at(i, j) = m.value(i, j);
+	}
+
+	return result;
+}
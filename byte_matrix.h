@@ -0,0 +1,150 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <vector>
+
+#include "matrix.h"
+
+// Read-only window into row-major bytes with a row stride, element (i, j) standing for at(i, j) * scale.
+// Datasets of 8-bit samples are kept this way and only converted by the kernels that read them,
+// e.g. images with a scale of 1 / 255 take a quarter of the memory of their float version.
+class byte_matrix_view
+{
+	const uint8_t* values = nullptr;
+	int width = 0;
+	int height = 0;
+	size_t stride = 0;
+	float scale = 1.f;
+
+public:
+	byte_matrix_view() {}
+
+	byte_matrix_view(const uint8_t* values, int width, int height, size_t stride, float scale)
+		: values(values), width(width), height(height), stride(stride), scale(scale)
+	{
+		assert(values);
+		assert(width > 0 && height > 0);
+		assert(stride >= (size_t)width);
+	}
+
+	byte_matrix_view(const uint8_t* values, int width, int height, float scale) : byte_matrix_view(values, width, height, (size_t)width, scale) {}
+
+	int get_width() const
+	{
+		return width;
+	}
+
+	int get_height() const
+	{
+		return height;
+	}
+
+	size_t get_stride() const
+	{
+		return stride;
+	}
+
+	float get_scale() const
+	{
+		return scale;
+	}
+
+	bool is_alive() const
+	{
+		return values;
+	}
+
+	const uint8_t* get_data() const
+	{
+		return values;
+	}
+
+	const uint8_t* row(int index) const
+	{
+		assert(index >= 0 && index < height);
+		return values + (size_t)index * stride;
+	}
+
+	float value(int row, int column) const
+	{
+		assert(row >= 0 && row < height);
+		assert(column >= 0 && column < width);
+		return values[(size_t)row * stride + column] * scale;
+	}
+
+	byte_matrix_view rows(int row_a, int row_b) const
+	{
+		assert(row_a >= 0 && row_a < row_b && row_b <= height);
+		return byte_matrix_view(values + (size_t)row_a * stride, width, row_b - row_a, stride, scale);
+	}
+};
+
+// Owned bytes with a scale, for datasets that don't come as bytes already
+class byte_matrix
+{
+	std::vector<uint8_t> values;
+	int width = 0;
+	int height = 0;
+	float scale = 1.f;
+
+public:
+	byte_matrix() {}
+
+	byte_matrix(int width, int height, float scale) : values((size_t)width * height), width(width), height(height), scale(scale)
+	{
+		assert(width > 0 && height > 0);
+		assert(scale > 0.f);
+	}
+
+	// Quantizes m to the nearest multiples of scale in [0, 255 * scale]
+	byte_matrix(const matrix_view& m, float scale);
+
+	int get_width() const
+	{
+		return width;
+	}
+
+	int get_height() const
+	{
+		return height;
+	}
+
+	float get_scale() const
+	{
+		return scale;
+	}
+
+	uint8_t* get_data()
+	{
+		return values.data();
+	}
+
+	const uint8_t* get_data() const
+	{
+		return values.data();
+	}
+
+	uint8_t& at(int row, int column)
+	{
+		assert(row >= 0 && row < height);
+		assert(column >= 0 && column < width);
+		return values[(size_t)row * width + column];
+	}
+
+	operator byte_matrix_view() const
+	{
+		return values.empty() ? byte_matrix_view() : byte_matrix_view(values.data(), width, height, scale);
+	}
+
+	byte_matrix_view rows(int row_a, int row_b) const
+	{
+		return byte_matrix_view(*this).rows(row_a, row_b);
+	}
+};
+
+// result = op(a) * op(b) with the bytes of a converted while they are packed
+void multiply(const byte_matrix_view& a, bool transpose_a, const matrix_view& b, bool transpose_b, matrix& result);
+
+// Float copy, e.g. for checking results against the float kernels
+matrix dequantize(const byte_matrix_view& m);
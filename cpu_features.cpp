@@ -0,0 +1,110 @@
+#include "cpu_features.h"
+#include <cstring>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_FEATURES_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef CPU_FEATURES_X86
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4])
+{
+#if defined(_MSC_VER)
+	int values[4];
+	__cpuidex(values, (int)leaf, (int)subleaf);
+	for (int i = 0; i < 4; i++)
+		registers[i] = (uint32_t)values[i];
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// Register state the operating system saves on context switches
+static uint64_t xgetbv()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t low, high;
+	__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return ((uint64_t)high << 32) | low;
+#endif
+}
+#endif
+
+instruction_set detect_instruction_set()
+{
+#ifdef CPU_FEATURES_X86
+	uint32_t registers[4];
+
+	cpuid(0, 0, registers);
+	const uint32_t max_leaf = registers[0];
+
+	cpuid(1, 0, registers);
+	const uint32_t features_ecx = registers[2];
+	const uint32_t features_edx = registers[3];
+
+	if (!(features_edx & (1u << 26)))
+		return instruction_set::scalar;
+
+	const bool osxsave = features_ecx & (1u << 27);
+	const bool avx = features_ecx & (1u << 28);
+	const bool fma = features_ecx & (1u << 12);
+	const bool f16c = features_ecx & (1u << 29); // Half conversions, which every AVX2 processor has
+	if (!osxsave || !avx || !fma || !f16c || max_leaf < 7)
+		return instruction_set::sse2;
+
+	const uint64_t xcr0 = xgetbv();
+	if ((xcr0 & 0x6) != 0x6) // XMM and YMM state
+		return instruction_set::sse2;
+
+	cpuid(7, 0, registers);
+	const uint32_t extended_features_ebx = registers[1];
+
+	if (!(extended_features_ebx & (1u << 5))) // AVX2
+		return instruction_set::sse2;
+
+	if (!(extended_features_ebx & (1u << 16)) || (xcr0 & 0xE0) != 0xE0) // AVX-512F and opmask/ZMM state
+		return instruction_set::avx2;
+
+	return instruction_set::avx512;
+#else
+	return instruction_set::scalar;
+#endif
+}
+
+const char* get_instruction_set_name(instruction_set isa)
+{
+	switch (isa)
+	{
+	case instruction_set::scalar:
+		return "scalar";
+	case instruction_set::sse2:
+		return "sse2";
+	case instruction_set::avx2:
+		return "avx2";
+	case instruction_set::avx512:
+		return "avx512";
+	}
+	return "unknown";
+}
+
+bool parse_instruction_set(const char* name, instruction_set& isa)
+{
+	const instruction_set all[] = { instruction_set::scalar, instruction_set::sse2, instruction_set::avx2, instruction_set::avx512 };
+
+	for (instruction_set candidate : all)
+	{
+		if (strcmp(name, get_instruction_set_name(candidate)) == 0)
+		{
+			isa = candidate;
+			return true;
+		}
+	}
+	return false;
+}
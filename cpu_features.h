@@ -0,0 +1,15 @@
+#pragma once
+
+// Instruction sets the matrix kernels are compiled for, from the most basic one
+enum class instruction_set
+{
+	scalar, sse2, avx2, avx512
+};
+
+// Best instruction set supported by both the CPU and the operating system
+instruction_set detect_instruction_set();
+
+const char* get_instruction_set_name(instruction_set isa);
+
+// Parses the names returned by get_instruction_set_name, returns false for unknown names
+bool parse_instruction_set(const char* name, instruction_set& isa);
@@ -0,0 +1,141 @@
+#include "data_loader.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+data_loader::data_loader(const mnist_data& data, int first_sample, int num_samples, int batch_size, int prefetch, int num_threads,
+	unsigned long long seed)
+	: data(data), first_sample(first_sample), num_samples(num_samples), batch_size(batch_size), buffers(prefetch + 1), generator(seed)
+{
+	assert(first_sample >= 0 && num_samples > 0 && first_sample + num_samples <= data.num_samples);
+	assert(batch_size > 0 && batch_size <= num_samples);
+	assert(prefetch > 0);
+	assert(num_threads > 0);
+
+	for (buffer& b : buffers)
+	{
+		b.input = byte_matrix(data.get_sample_size(), batch_size, mnist_pixel_scale);
+		b.required_output = matrix(mnist_num_classes, batch_size);
+		b.samples.reserve(batch_size);
+	}
+
+	order.resize(num_samples);
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), generator);
+
+	threads.reserve(num_threads);
+	for (int i = 0; i < num_threads; i++)
+		threads.emplace_back(&data_loader::worker_loop, this);
+}
+
+data_loader::~data_loader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	producer_cv.notify_all();
+
+	for (std::thread& t : threads)
+		t.join();
+}
+
+void data_loader::worker_loop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		// A batch can only be claimed once the caller gave back the batch that used its buffer before
+		producer_cv.wait(lock, [&] { return stop || next_claimed < num_released + (long long)buffers.size(); });
+		if (stop) return;
+
+		buffer& b = buffers[next_claimed % buffers.size()];
+		next_claimed++;
+
+		// Batches are claimed in order, so the epochs are cut from the sample order here
+		const int count = std::min(batch_size, num_samples - order_position);
+		b.samples.assign(order.begin() + order_position, order.begin() + order_position + count);
+		b.info.epoch = epoch;
+		b.info.index = epoch_batch++;
+
+		order_position += count;
+		if (order_position == num_samples)
+		{
+			std::shuffle(order.begin(), order.end(), generator);
+			order_position = 0;
+			epoch++;
+			epoch_batch = 0;
+		}
+
+		lock.unlock();
+
+		const clock::time_point start = clock::now();
+		const int sample_size = data.get_sample_size();
+		for (int i = 0; i < count; i++)
+		{
+			const int index = first_sample + b.samples[i];
+			memcpy(b.input.get_data() + (size_t)i * sample_size, data.get_image(index), sample_size);
+
+			float* required_row = b.required_output.get_data() + (size_t)i * mnist_num_classes;
+			for (int k = 0; k < mnist_num_classes; k++)
+				required_row[k] = 0.f;
+			required_row[data.get_label(index)] = 1.f;
+		}
+		b.info.input = b.input.rows(0, count);
+		b.info.required_output = b.required_output.rows(0, count);
+		b.info.load_time = std::chrono::duration<double>(clock::now() - start).count();
+
+		lock.lock();
+		b.ready = true;
+		consumer_cv.notify_all();
+	}
+}
+
+const data_loader::batch& data_loader::next()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// The previous batch is done with
+	if (next_returned > num_released)
+	{
+		buffers[num_released % buffers.size()].ready = false;
+		num_released++;
+		producer_cv.notify_one();
+	}
+
+	buffer& b = buffers[next_returned % buffers.size()];
+	next_returned++;
+
+	const clock::time_point start = clock::now();
+	const bool stalled = !b.ready;
+	consumer_cv.wait(lock, [&] { return b.ready; });
+	b.info.stall_time = stalled ? std::chrono::duration<double>(clock::now() - start).count() : 0.;
+
+	stats.batches++;
+	stats.stalls += stalled;
+	total_load_time += b.info.load_time;
+	stats.max_load_time = std::max(stats.max_load_time, b.info.load_time);
+	stats.total_stall_time += b.info.stall_time;
+	stats.max_stall_time = std::max(stats.max_stall_time, b.info.stall_time);
+
+	return b.info;
+}
+
+data_loader::statistics data_loader::get_statistics()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	statistics result = stats;
+	if (result.batches)
+		result.mean_load_time = total_load_time / result.batches;
+
+	return result;
+}
+
+void data_loader::reset_statistics()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stats = statistics();
+	total_load_time = 0;
+}
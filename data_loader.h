@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+
+#include "matrix.h"
+#include "byte_matrix.h"
+#include "mnist.h"
+
+// Shuffled mini-batches of an MNIST data set, assembled ahead of time by background threads.
+// Every epoch visits the samples once in a new random order, the last batch of an epoch may be smaller.
+// The threads keep up to prefetch batches ready in buffers allocated once, so while the caller trains
+// on one batch the next ones are being gathered, and the caller only waits when it is faster than them.
+// The pixels stay bytes, the first layer of the network converts them while multiplying.
+class data_loader
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct batch
+	{
+		byte_matrix_view input; // Pixels as bytes, with a scale of mnist_pixel_scale
+		matrix_view required_output;
+		int epoch = 0;
+		int index = 0; // Within the epoch
+		double load_time = 0; // Seconds a background thread spent assembling the batch
+		double stall_time = 0; // Seconds next() waited for it
+	};
+
+	struct statistics
+	{
+		size_t batches = 0;
+		size_t stalls = 0; // Batches that weren't ready when next() asked for them
+		double mean_load_time = 0;
+		double max_load_time = 0;
+		double total_stall_time = 0;
+		double max_stall_time = 0;
+	};
+
+private:
+	struct buffer
+	{
+		byte_matrix input;
+		matrix required_output;
+		std::vector<int> samples;
+		batch info;
+		bool ready = false;
+	};
+
+	const mnist_data& data;
+	int first_sample;
+	int num_samples;
+	int batch_size;
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable producer_cv;
+	std::condition_variable consumer_cv;
+	bool stop = false;
+
+	// Batch n is assembled in buffers[n % buffers.size()]
+	std::vector<buffer> buffers;
+	long long next_claimed = 0; // Next batch a thread will assemble
+	long long next_returned = 0; // Next batch next() will return
+	long long num_released = 0; // Batches whose buffer the caller gave back
+
+	// Sample order of the epoch being claimed
+	std::mt19937_64 generator;
+	std::vector<int> order;
+	int order_position = 0;
+	int epoch = 0;
+	int epoch_batch = 0;
+
+	double total_load_time = 0;
+	statistics stats;
+
+	void worker_loop();
+
+public:
+	// Batches over num_samples samples starting at first_sample. prefetch batches are kept ready ahead of
+	// the one being used, by num_threads threads.
+	data_loader(const mnist_data& data, int first_sample, int num_samples, int batch_size, int prefetch = 2, int num_threads = 1,
+		unsigned long long seed = std::random_device()());
+
+	data_loader(const data_loader&) = delete;
+	data_loader& operator=(const data_loader&) = delete;
+
+	~data_loader();
+
+	int get_batches_per_epoch() const
+	{
+		return (num_samples + batch_size - 1) / batch_size;
+	}
+
+	// Waits for the next batch, it stays valid until the following call. The buffer of the previous batch is given back.
+	const batch& next();
+
+	statistics get_statistics();
+
+	void reset_statistics();
+};
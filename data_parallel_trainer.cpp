@@ -0,0 +1,99 @@
+#include "data_parallel_trainer.h"
+#include "auxiliary.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+
+data_parallel_trainer::data_parallel_trainer(neural_net& net, int max_batch_size, int num_workers) : net(net), max_batch_size(max_batch_size)
+{
+	assert(max_batch_size > 0);
+	assert(net.get_weight_precision() == weight_precision::fp32);
+	assert(num_workers >= 0);
+
+	if (num_workers == 0)
+		num_workers = thread_pool::instance().get_num_threads();
+	num_workers = std::min(num_workers, max_batch_size);
+
+	const int max_shard_size = (max_batch_size + num_workers - 1) / num_workers;
+
+	workspaces.reserve(num_workers);
+	for (int i = 0; i < num_workers; i++)
+		workspaces.emplace_back(net, max_shard_size);
+}
+
+void data_parallel_trainer::all_reduce(int num_shards)
+{
+	thread_pool& pool = thread_pool::instance();
+
+	// Pairwise sums, each level halves the number of partial gradients
+	for (int stride = 1; stride < num_shards; stride *= 2)
+	{
+		const int num_pairs = (num_shards + 2 * stride - 1) / (2 * stride);
+
+		pool.parallel_for(num_pairs, [&](int pair)
+		{
+			const int target = pair * 2 * stride;
+			const int source = target + stride;
+			if (source >= num_shards) return;
+
+			auto& sum = workspaces[target].gradient;
+			const auto& part = workspaces[source].gradient;
+
+			for (size_t i = 0; i < sum.size(); i++)
+			{
+				axpby(1.f, part[i].weights, 1.f, sum[i].weights);
+				axpby(1.f, part[i].biases, 1.f, sum[i].biases);
+			}
+		});
+	}
+}
+
+void data_parallel_trainer::step(const matrix_view& input, const matrix_view& required_output, float rate)
+{
+	assert(input.get_height() == required_output.get_height());
+	assert(input.get_height() <= max_batch_size);
+
+	const int rows = input.get_height();
+	const int num_shards = std::min(get_num_workers(), rows);
+
+	// Shard sizes differ by at most one row, so every shard has rows and fits the workspaces
+	thread_pool::instance().parallel_for(num_shards, [&](int shard)
+	{
+		neural_net::training_workspace& ws = workspaces[shard];
+		const int row_a = (int)((long long)shard * rows / num_shards);
+		const int row_b = (int)((long long)(shard + 1) * rows / num_shards);
+
+		// The shard is read in place
+		net.backpropagation(input.rows(row_a, row_b), required_output.rows(row_a, row_b), ws);
+	});
+
+	all_reduce(num_shards);
+
+	net.apply_gradient(workspaces[0], rate);
+}
+
+void data_parallel_trainer::train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate)
+{
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	for (int i = 0; i < iter_num; i++)
+	{
+		step(input, required_output, rate);
+	}
+}
+
+void data_parallel_trainer::train_mini_batch(const std::vector<matrix>& input, const std::vector<matrix>& required_output, int iter_num, float rate)
+{
+	assert(input.size() == required_output.size());
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	const int num_batches = (int)input.size();
+
+	for (int i = 0; i < iter_num; i++)
+	{
+		const int batch_index = random_int(0, num_batches - 1);
+		step(input[batch_index], required_output[batch_index], rate);
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+
+#include "neural_net.h"
+
+// Synchronous data-parallel training: every batch is split into shards, one per worker of the thread pool.
+// Each worker runs forward and backward passes on its shard with its own workspace, the gradients
+// are summed with a tree all-reduce and applied to the network in one update.
+// The result is the same as neural_net::train_batch up to float reassociation.
+class data_parallel_trainer
+{
+	neural_net& net;
+	int max_batch_size;
+	std::vector<neural_net::training_workspace> workspaces;
+
+	// Sums the gradients of the first num_shards workspaces into workspaces[0]
+	void all_reduce(int num_shards);
+
+public:
+	// num_workers = 0 uses every thread of the pool
+	data_parallel_trainer(neural_net& net, int max_batch_size, int num_workers = 0);
+
+	int get_num_workers() const
+	{
+		return (int)workspaces.size();
+	}
+
+	// One update over the whole batch, sharded by rows
+	void step(const matrix_view& input, const matrix_view& required_output, float rate);
+
+	void train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate);
+
+	void train_mini_batch(const std::vector<matrix>& input, const std::vector<matrix>& required_output, int iter_num, float rate);
+};
@@ -0,0 +1,154 @@
+#include "dense_layer.h"
+#include "gemm.h"
+
+// Product of the layer's input and weights, bytes are converted while the input is packed
+template<typename Weights>
+static void multiply_input(const matrix_view& input, const Weights& weights, float* output, const gemm_epilogue& epilogue)
+{
+	gemm(false, false, input.get_height(), weights.get_width(), weights.get_height(), input.get_data(), input.get_stride(),
+		weights.get_data(), weights.get_width(), output, weights.get_width(), epilogue);
+}
+
+template<typename Weights>
+static void multiply_input(const byte_matrix_view& input, const Weights& weights, float* output, const gemm_epilogue& epilogue)
+{
+	gemm(false, false, input.get_height(), weights.get_width(), weights.get_height(), input.get_data(), input.get_stride(), input.get_scale(),
+		weights.get_data(), weights.get_width(), output, weights.get_width(), epilogue);
+}
+
+template<typename Input, typename Weights>
+static void forward(const Input& input, const Weights& weights, const matrix& biases, activation f, float* output)
+{
+	assert(input.is_alive() && output);
+	assert(input.get_width() == weights.get_height());
+	assert(weights.is_alive() && biases.is_alive());
+	assert(biases.get_width() == weights.get_width() && biases.get_height() == 1);
+
+	const int rows = input.get_height();
+	const int output_size = weights.get_width();
+
+	gemm_epilogue epilogue;
+	epilogue.bias = biases.get_data();
+	epilogue.f = f == activation::softmax ? activation::linear : f;
+
+	multiply_input(input, weights, output, epilogue);
+
+	// Softmax is normalized over whole rows, so it runs after the product
+	if (f == activation::softmax)
+	{
+		for (int i = 0; i < rows; i++)
+			activate(f, output + (size_t)i * output_size, output_size);
+	}
+}
+
+void dense_forward(const matrix_view& input, const matrix& weights, const matrix& biases, activation f, matrix& output)
+{
+	assert(input.is_alive());
+	assert(output.get_data() != input.get_data() && &output != &weights);
+
+	output.resize(weights.get_width(), input.get_height());
+
+	forward(input, weights, biases, f, output.get_data());
+}
+
+void dense_forward(const matrix_view& input, const matrix& weights, const matrix& biases, activation f, float* output)
+{
+	forward(input, weights, biases, f, output);
+}
+
+void dense_forward(const byte_matrix_view& input, const matrix& weights, const matrix& biases, activation f, matrix& output)
+{
+	assert(input.is_alive());
+	assert(&output != &weights);
+
+	output.resize(weights.get_width(), input.get_height());
+
+	forward(input, weights, biases, f, output.get_data());
+}
+
+template<typename T>
+void dense_forward(const matrix_view& input, const basic_matrix<T>& weights, const matrix& biases, activation f, matrix& output)
+{
+	assert(input.is_alive());
+	assert(output.get_data() != input.get_data());
+
+	output.resize(weights.get_width(), input.get_height());
+
+	forward(input, weights, biases, f, output.get_data());
+}
+
+template<typename T>
+void dense_forward(const matrix_view& input, const basic_matrix<T>& weights, const matrix& biases, activation f, float* output)
+{
+	forward(input, weights, biases, f, output);
+}
+
+template<typename T>
+void dense_forward(const byte_matrix_view& input, const basic_matrix<T>& weights, const matrix& biases, activation f, matrix& output)
+{
+	assert(input.is_alive());
+
+	output.resize(weights.get_width(), input.get_height());
+
+	forward(input, weights, biases, f, output.get_data());
+}
+
+template void dense_forward(const matrix_view&, const half_matrix&, const matrix&, activation, matrix&);
+template void dense_forward(const matrix_view&, const bfloat16_matrix&, const matrix&, activation, matrix&);
+template void dense_forward(const matrix_view&, const half_matrix&, const matrix&, activation, float*);
+template void dense_forward(const matrix_view&, const bfloat16_matrix&, const matrix&, activation, float*);
+template void dense_forward(const byte_matrix_view&, const half_matrix&, const matrix&, activation, matrix&);
+template void dense_forward(const byte_matrix_view&, const bfloat16_matrix&, const matrix&, activation, matrix&);
+
+// Multiplies delta by the derivative, expressed through the layer's output, and sums the rows
+template<typename Derivative>
+static void backward_sweep(matrix& delta, const matrix& output, float* bias_gradient, Derivative derivative)
+{
+	const int width = delta.get_width();
+
+	for (int j = 0; j < width; j++)
+		bias_gradient[j] = 0.f;
+
+	for (int i = 0; i < delta.get_height(); i++)
+	{
+		float* delta_row = delta.get_data() + (size_t)i * width;
+		const float* output_row = output.get_data() + (size_t)i * width;
+
+		for (int j = 0; j < width; j++)
+		{
+			const float d = delta_row[j] * derivative(output_row[j]);
+			delta_row[j] = d;
+			bias_gradient[j] += d;
+		}
+	}
+}
+
+void dense_backward(matrix& delta, const matrix& output, activation f, matrix& bias_gradient)
+{
+	assert(delta.is_alive() && output.is_alive());
+	assert(delta.get_width() == output.get_width());
+	assert(delta.get_height() == output.get_height());
+	assert(&bias_gradient != &delta && &bias_gradient != &output);
+
+	bias_gradient.resize(delta.get_width(), 1);
+
+	switch (f)
+	{
+	case activation::linear:
+		backward_sweep(delta, output, bias_gradient.get_data(), [](float) { return 1.f; });
+		break;
+	case activation::sigmoid:
+		backward_sweep(delta, output, bias_gradient.get_data(), [](float y) { return y * (1.f - y); });
+		break;
+	case activation::relu:
+		backward_sweep(delta, output, bias_gradient.get_data(), [](float y) { return y > 0.f ? 1.f : 0.f; });
+		break;
+	case activation::tanh:
+		backward_sweep(delta, output, bias_gradient.get_data(), [](float y) { return 1.f - y * y; });
+		break;
+	case activation::softmax:
+		// Paired with the cross-entropy loss, output - required output already is the gradient of the pre-activation values
+		backward_sweep(delta, output, bias_gradient.get_data(), [](float) { return 1.f; });
+		break;
+	}
+}
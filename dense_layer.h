@@ -0,0 +1,31 @@
+#pragma once
+#include "matrix.h"
+#include "byte_matrix.h"
+#include "half_matrix.h"
+#include "activation.h"
+
+// Forward pass of a fully connected layer: output = f(input * weights + biases).
+// The biases and the activation are applied in the GEMM epilogue, so output is written only once.
+// The input is read in place, so a range of rows of a dataset can be passed without copying it.
+void dense_forward(const matrix_view& input, const matrix& weights, const matrix& biases, activation f, matrix& output);
+
+// Same with a raw row-major output buffer of input.get_height() x weights.get_width() values
+void dense_forward(const matrix_view& input, const matrix& weights, const matrix& biases, activation f, float* output);
+
+// Same with an input of bytes, which are converted to floats as the GEMM packs them
+void dense_forward(const byte_matrix_view& input, const matrix& weights, const matrix& biases, activation f, matrix& output);
+
+// Same with weights kept in 16 bits, half_matrix or bfloat16_matrix, which the GEMM converts to floats as it reads them
+template<typename T>
+void dense_forward(const matrix_view& input, const basic_matrix<T>& weights, const matrix& biases, activation f, matrix& output);
+
+template<typename T>
+void dense_forward(const matrix_view& input, const basic_matrix<T>& weights, const matrix& biases, activation f, float* output);
+
+template<typename T>
+void dense_forward(const byte_matrix_view& input, const basic_matrix<T>& weights, const matrix& biases, activation f, matrix& output);
+
+// Start of the backward pass of a fully connected layer, done in a single sweep over delta:
+// delta = delta * f'(output) element-wise, and bias_gradient is the sum of the rows of the new delta.
+// For softmax delta is expected to be output - required output of the cross-entropy loss and is left as is.
+void dense_backward(matrix& delta, const matrix& output, activation f, matrix& bias_gradient);
@@ -0,0 +1,310 @@
+#include "gemm.h"
+#include "kernels.h"
+#include "thread_pool.h"
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+// The multiplication is split the usual way: B is packed into KC x NC panels that stay in L2,
+// A into MC x KC blocks that stay in L1/L2, and an MR x NR microkernel keeps its tile of C in registers.
+// MR and NR depend on the vector width, so they come from the kernel table selected at run time.
+
+static constexpr int MC = 128;
+static constexpr int KC = 256;
+static constexpr int NC = 2048;
+
+// Address of the logical element (row, column) of an operand that is stored transposed or not
+template<typename T>
+static const T* element(const T* p, size_t ld, bool transposed, int row, int column)
+{
+	return transposed ? p + (size_t)column * ld + row : p + (size_t)row * ld + column;
+}
+
+// Float value of an element of A, bytes are scaled on the way into the packed block
+static float unpack(float value, float)
+{
+	return value;
+}
+
+static float unpack(uint8_t value, float scale)
+{
+	return value * scale;
+}
+
+// Packs an mc x kc block of A into row panels of MR rows, each stored column by column
+template<typename T>
+static void pack_a(int MR, int mc, int kc, const T* a, size_t lda, float scale, bool transposed, float* packed)
+{
+	for (int i = 0; i < mc; i += MR)
+	{
+		const int mr = std::min(MR, mc - i);
+		for (int p = 0; p < kc; p++)
+		{
+			int r = 0;
+			if (transposed)
+			{
+				const T* column = a + (size_t)p * lda + i;
+				for (; r < mr; r++)
+					packed[r] = unpack(column[r], scale);
+			}
+			else
+			{
+				for (; r < mr; r++)
+					packed[r] = unpack(a[(size_t)(i + r) * lda + p], scale);
+			}
+			for (; r < MR; r++)
+				packed[r] = 0.f;
+			packed += MR;
+		}
+	}
+}
+
+// Packs a kc x nc block of B into column panels of NR columns, each stored row by row.
+// B may be stored in 16 bits, the packed panel is always floats.
+template<typename T>
+static void pack_b(int NR, int kc, int nc, const T* b, size_t ldb, bool transposed, float* packed)
+{
+	for (int j = 0; j < nc; j += NR)
+	{
+		const int nr = std::min(NR, nc - j);
+		if (transposed)
+		{
+			// Columns of B are rows in memory, so read each of them contiguously
+			for (int c = 0; c < NR; c++)
+			{
+				const T* column = b + (size_t)(j + c) * ldb;
+				for (int p = 0; p < kc; p++)
+					packed[(size_t)p * NR + c] = c < nr ? to_float(column[p]) : 0.f;
+			}
+			packed += (size_t)kc * NR;
+		}
+		else
+		{
+			for (int p = 0; p < kc; p++)
+			{
+				const T* row = b + (size_t)p * ldb + j;
+				int c = 0;
+				for (; c < nr; c++)
+					packed[c] = to_float(row[c]);
+				for (; c < NR; c++)
+					packed[c] = 0.f;
+				packed += NR;
+			}
+		}
+	}
+}
+
+// Minimal number of multiply-adds in one thread's part of the product
+static constexpr size_t PARALLEL_GRAIN = 1 << 18;
+
+template<typename TA, typename TB>
+static void gemm_serial(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const TA* a, size_t lda, float a_scale, const TB* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	const kernel_table& kernel = kernels();
+	const int MR = kernel.gemm_mr;
+	const int NR = kernel.gemm_nr;
+	const int mc_size = std::max(MC / MR, 1) * MR;
+
+	// Split k into equal blocks so that the last one is not tiny
+	const int k_blocks = (k + KC - 1) / KC;
+	const int kc_size = (k + k_blocks - 1) / k_blocks;
+
+	thread_local std::vector<float> packed_a;
+	thread_local std::vector<float> packed_b;
+	packed_a.resize((size_t)mc_size * KC);
+	packed_b.resize((size_t)KC * ((NC + NR - 1) / NR * NR));
+
+	for (int jc = 0; jc < n; jc += NC)
+	{
+		const int nc = std::min(NC, n - jc);
+
+		for (int pc = 0; pc < k; pc += kc_size)
+		{
+			const int kc = std::min(kc_size, k - pc);
+			const bool accumulate = pc != 0;
+			const bool last = pc + kc >= k;
+
+			pack_b(NR, kc, nc, element(b, ldb, transpose_b, pc, jc), ldb, transpose_b, packed_b.data());
+
+			for (int ic = 0; ic < m; ic += mc_size)
+			{
+				const int mc = std::min(mc_size, m - ic);
+
+				pack_a(MR, mc, kc, element(a, lda, transpose_a, ic, pc), lda, a_scale, transpose_a, packed_a.data());
+
+				for (int jr = 0; jr < nc; jr += NR)
+				{
+					const int nr = std::min(NR, nc - jr);
+					const float* b_panel = packed_b.data() + (size_t)jr * kc;
+
+					gemm_epilogue tile_epilogue = epilogue;
+					if (tile_epilogue.bias) tile_epilogue.bias += jc + jr;
+
+					for (int ir = 0; ir < mc; ir += MR)
+					{
+						const int mr = std::min(MR, mc - ir);
+						const float* a_panel = packed_a.data() + (size_t)ir * kc;
+
+						kernel.gemm_micro_kernel(kc, a_panel, b_panel, c + (size_t)(ic + ir) * ldc + jc + jr, ldc, mr, nr, accumulate,
+							last ? &tile_epilogue : nullptr);
+					}
+				}
+			}
+		}
+	}
+}
+
+// A single row of A as floats, bytes are converted into a buffer of the calling thread
+static const float* unpack_row(const float* a, int, float)
+{
+	return a;
+}
+
+static const float* unpack_row(const uint8_t* a, int k, float scale)
+{
+	thread_local std::vector<float> row;
+	row.resize(k);
+	for (int p = 0; p < k; p++)
+		row[p] = a[p] * scale;
+	return row.data();
+}
+
+// Row vector times B with the kernel for the storage type of B
+static void gemv(const kernel_table& kernel, int n, int k, const float* x, const float* b, size_t ldb, float* y, const gemm_epilogue* epilogue)
+{
+	kernel.gemv(n, k, x, b, ldb, y, epilogue);
+}
+
+static void gemv(const kernel_table& kernel, int n, int k, const float* x, const float16* b, size_t ldb, float* y, const gemm_epilogue* epilogue)
+{
+	kernel.gemv_f16(n, k, x, b, ldb, y, epilogue);
+}
+
+static void gemv(const kernel_table& kernel, int n, int k, const float* x, const bfloat16* b, size_t ldb, float* y, const gemm_epilogue* epilogue)
+{
+	kernel.gemv_bf16(n, k, x, b, ldb, y, epilogue);
+}
+
+template<typename TA, typename TB>
+static void gemm_dispatch(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const TA* a, size_t lda, float a_scale, const TB* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	assert(m >= 0 && n >= 0 && k >= 0);
+	assert(a && b && c);
+	assert(epilogue.f != activation::softmax); // Needs whole rows, tiles only see a part of them
+
+	if (m == 0 || n == 0) return;
+
+	if (k == 0)
+	{
+		for (int i = 0; i < m; i++)
+		{
+			float* c_row = c + (size_t)i * ldc;
+			for (int j = 0; j < n; j++)
+				c_row[j] = epilogue.bias ? epilogue.bias[j] : 0.f;
+			activate(epilogue.f, c_row, n);
+		}
+		return;
+	}
+
+	thread_pool& pool = thread_pool::instance();
+
+	const size_t work = (size_t)m * n * k;
+
+	// A single row, as in one-sample inference: nothing to pack, B is streamed once
+	if (m == 1 && !transpose_a && !transpose_b)
+	{
+		const kernel_table& kernel = kernels();
+		const float* x = unpack_row(a, k, a_scale);
+		const int num_parts = (int)std::min<size_t>(work / PARALLEL_GRAIN, (size_t)pool.get_num_threads());
+
+		if (num_parts <= 1 || thread_pool::is_worker_thread())
+		{
+			gemv(kernel, n, k, x, b, ldb, c, &epilogue);
+			return;
+		}
+
+		const int columns_per_part = ((n + num_parts - 1) / num_parts + kernel.gemm_nr - 1) / kernel.gemm_nr * kernel.gemm_nr;
+		pool.parallel_for(num_parts, [&](int part)
+		{
+			const int column = part * columns_per_part;
+			if (column >= n) return;
+
+			gemm_epilogue part_epilogue = epilogue;
+			if (part_epilogue.bias) part_epilogue.bias += column;
+
+			gemv(kernel, std::min(columns_per_part, n - column), k, x, b + column, ldb, c + column, &part_epilogue);
+		});
+		return;
+	}
+
+	int num_parts = (int)std::min<size_t>(work / PARALLEL_GRAIN, (size_t)pool.get_num_threads());
+
+	if (num_parts <= 1 || thread_pool::is_worker_thread())
+	{
+		gemm_serial(transpose_a, transpose_b, m, n, k, a, lda, a_scale, b, ldb, c, ldc, epilogue);
+		return;
+	}
+
+	// Split C into a grid of independent products, preferring row blocks since every part repacks its own B panel
+	const int MR = kernels().gemm_mr;
+	const int NR = kernels().gemm_nr;
+	const int m_panels = (m + MR - 1) / MR;
+	const int n_panels = (n + NR - 1) / NR;
+	const int m_parts = std::min(num_parts, m_panels);
+	const int n_parts = std::min(std::max(num_parts / m_parts, 1), n_panels);
+	const int rows_per_part = (m_panels + m_parts - 1) / m_parts * MR;
+	const int columns_per_part = (n_panels + n_parts - 1) / n_parts * NR;
+
+	pool.parallel_for(m_parts * n_parts, [&](int part)
+	{
+		const int row = part / n_parts * rows_per_part;
+		const int column = part % n_parts * columns_per_part;
+		if (row >= m || column >= n) return;
+
+		gemm_epilogue part_epilogue = epilogue;
+		if (part_epilogue.bias) part_epilogue.bias += column;
+
+		gemm_serial(transpose_a, transpose_b, std::min(rows_per_part, m - row), std::min(columns_per_part, n - column), k,
+			element(a, lda, transpose_a, row, 0), lda, a_scale, element(b, ldb, transpose_b, 0, column), ldb, c + (size_t)row * ldc + column, ldc,
+			part_epilogue);
+	});
+}
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	gemm_dispatch(transpose_a, transpose_b, m, n, k, a, lda, 1.f, b, ldb, c, ldc, epilogue);
+}
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const uint8_t* a, size_t lda, float a_scale, const float* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	gemm_dispatch(transpose_a, transpose_b, m, n, k, a, lda, a_scale, b, ldb, c, ldc, epilogue);
+}
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const float* a, size_t lda, const float16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	gemm_dispatch(transpose_a, transpose_b, m, n, k, a, lda, 1.f, b, ldb, c, ldc, epilogue);
+}
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const float* a, size_t lda, const bfloat16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	gemm_dispatch(transpose_a, transpose_b, m, n, k, a, lda, 1.f, b, ldb, c, ldc, epilogue);
+}
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const uint8_t* a, size_t lda, float a_scale, const float16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	gemm_dispatch(transpose_a, transpose_b, m, n, k, a, lda, a_scale, b, ldb, c, ldc, epilogue);
+}
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const uint8_t* a, size_t lda, float a_scale, const bfloat16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue)
+{
+	gemm_dispatch(transpose_a, transpose_b, m, n, k, a, lda, a_scale, b, ldb, c, ldc, epilogue);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "activation.h"
+#include "half.h"
+
+// Work applied to every tile of C right after its last k block, while the tile is still hot:
+// C = f(C + bias), where bias holds one value per column of C and may be null
+struct gemm_epilogue
+{
+	const float* bias = nullptr;
+	activation f = activation::linear;
+};
+
+// General matrix multiplication for row-major data: C = op(A) * op(B),
+// where op(A) is m x k, op(B) is k x n and C is m x n.
+// A transposed operand is read in place, so for transpose_a A is stored as a k x m matrix.
+// lda, ldb and ldc are row strides in elements.
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue = gemm_epilogue());
+
+// Same with A stored as bytes, each standing for its value times a_scale.
+// They are converted to floats while A is packed, so a float copy of A never leaves the cache.
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const uint8_t* a, size_t lda, float a_scale, const float* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue = gemm_epilogue());
+
+// Versions with B stored in 16 bits, e.g. weights kept in half precision. Panels of B are converted as they are packed,
+// a single row of A streams B once and converts it in registers. Sums are accumulated in floats.
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const float* a, size_t lda, const float16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue = gemm_epilogue());
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const float* a, size_t lda, const bfloat16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue = gemm_epilogue());
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const uint8_t* a, size_t lda, float a_scale, const float16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue = gemm_epilogue());
+
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k,
+	const uint8_t* a, size_t lda, float a_scale, const bfloat16* b, size_t ldb, float* c, size_t ldc, const gemm_epilogue& epilogue = gemm_epilogue());
+
+inline void gemm(int m, int n, int k, const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc)
+{
+	gemm(false, false, m, n, k, a, lda, b, ldb, c, ldc);
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+// 16-bit floating point storage types. Values are converted to floats for any arithmetic,
+// they only save memory and bandwidth.
+
+// IEEE 754 half precision: 5 exponent bits, 10 mantissa bits, largest finite value 65504
+struct float16
+{
+	uint16_t bits;
+
+	// Rounds to the nearest value, ties to even, overflowing to infinity
+	static float16 from_float(float value);
+};
+
+// Upper half of a float: the float exponent range with 7 mantissa bits
+struct bfloat16
+{
+	uint16_t bits;
+
+	// Rounds to the nearest value, ties to even
+	static bfloat16 from_float(float value);
+};
+
+inline float to_float(float value)
+{
+	return value;
+}
+
+inline float to_float(bfloat16 value)
+{
+	const uint32_t bits = (uint32_t)value.bits << 16;
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+inline bfloat16 bfloat16::from_float(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	// Keeps NaNs quiet, rounding could turn their mantissa into zero, which is infinity
+	if ((bits & 0x7FFFFFFFu) > 0x7F800000u)
+		return { (uint16_t)(bits >> 16 | 0x40) };
+
+	bits += 0x7FFFu + (bits >> 16 & 1);
+	return { (uint16_t)(bits >> 16) };
+}
+
+inline float to_float(float16 value)
+{
+	const uint32_t sign = (uint32_t)(value.bits & 0x8000) << 16;
+	const uint32_t exponent = value.bits >> 10 & 0x1F;
+	const uint32_t mantissa = value.bits & 0x3FF;
+
+	uint32_t bits;
+	if (exponent == 0x1F)
+	{
+		bits = sign | 0x7F800000u | mantissa << 13; // Infinity or NaN
+	}
+	else if (exponent == 0)
+	{
+		// Zero or subnormal, mantissa * 2^-24
+		const float magnitude = (float)mantissa * 5.9604644775390625e-8f;
+		return sign ? -magnitude : magnitude;
+	}
+	else
+	{
+		bits = sign | (exponent + 112) << 23 | mantissa << 13;
+	}
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+inline float16 float16::from_float(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint16_t sign = (uint16_t)(bits >> 16 & 0x8000);
+	const uint32_t magnitude = bits & 0x7FFFFFFFu;
+
+	if (magnitude > 0x7F800000u)
+		return { (uint16_t)(sign | 0x7E00) }; // NaN
+	if (magnitude >= 0x477FF000u)
+		return { (uint16_t)(sign | 0x7C00) }; // 65520 and above round to infinity
+	if (magnitude < 0x33000000u)
+		return { sign }; // 2^-25 and below round to zero
+
+	uint32_t result;
+	uint32_t remainder;
+	uint32_t halfway;
+	if (magnitude < 0x38800000u)
+	{
+		// Subnormal, the mantissa with its implicit bit shifted to units of 2^-24
+		const uint32_t mantissa = (magnitude & 0x7FFFFFu) | 0x800000u;
+		const uint32_t shift = 126 - (magnitude >> 23);
+		result = mantissa >> shift;
+		remainder = mantissa & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+	}
+	else
+	{
+		// Normal, rebiases the exponent from 127 to 15, a carry out of the mantissa moves to the exponent
+		result = (magnitude - 0x38000000u) >> 13;
+		remainder = magnitude & 0x1FFF;
+		halfway = 0x1000;
+	}
+
+	if (remainder > halfway || (remainder == halfway && (result & 1)))
+		result++;
+
+	return { (uint16_t)(sign | result) };
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <cassert>
+#include <vector>
+
+#include "half.h"
+#include "matrix.h"
+
+// Precision the weights of a network are kept in, in memory and in model files.
+// The values are stored in model files, so new ones go at the end.
+enum class weight_precision
+{
+	fp32, fp16, bf16
+};
+
+// Read-only row-major matrix of 16-bit floating point values, for weights that are only used for inference.
+// It takes half the memory and bandwidth of a float matrix, the GEMM converts the values to floats in registers
+// and accumulates in floats.
+template<typename T>
+class basic_matrix
+{
+	std::vector<T> storage;
+	const T* values = nullptr; // storage.data(), or an external buffer, see wrap()
+	int width = 0;
+	int height = 0;
+
+public:
+	basic_matrix() {}
+
+	// Rounds the values of m to the nearest values of T
+	explicit basic_matrix(const matrix_view& m) : storage((size_t)m.get_width() * m.get_height()), width(m.get_width()), height(m.get_height())
+	{
+		for (int i = 0; i < height; i++)
+		{
+			const float* row = m.row(i);
+			for (int j = 0; j < width; j++)
+				storage[(size_t)i * width + j] = T::from_float(row[j]);
+		}
+		values = storage.data();
+	}
+
+	// Copies width * height values
+	basic_matrix(const T* values, int width, int height) : storage(values, values + (size_t)width * height), width(width), height(height)
+	{
+		this->values = storage.data();
+	}
+
+	basic_matrix(const basic_matrix& m) : storage(m.storage), values(m.storage.empty() ? m.values : storage.data()), width(m.width), height(m.height) {}
+
+	basic_matrix(basic_matrix&& m) noexcept : storage(std::move(m.storage)), values(m.values), width(m.width), height(m.height)
+	{
+		m.values = nullptr;
+		m.width = 0;
+		m.height = 0;
+	}
+
+	basic_matrix& operator=(const basic_matrix& m)
+	{
+		if (this != &m)
+		{
+			storage = m.storage;
+			values = m.storage.empty() ? m.values : storage.data();
+			width = m.width;
+			height = m.height;
+		}
+		return *this;
+	}
+
+	basic_matrix& operator=(basic_matrix&& m) noexcept
+	{
+		storage = std::move(m.storage);
+		values = m.values;
+		width = m.width;
+		height = m.height;
+		m.values = nullptr;
+		m.width = 0;
+		m.height = 0;
+		return *this;
+	}
+
+	// Matrix over an external buffer of width * height values, e.g. in a mapped model file, which must outlive it
+	static basic_matrix wrap(const T* values, int width, int height)
+	{
+		assert(values);
+		assert(width > 0 && height > 0);
+
+		basic_matrix result;
+		result.values = values;
+		result.width = width;
+		result.height = height;
+		return result;
+	}
+
+	int get_width() const
+	{
+		return width;
+	}
+
+	int get_height() const
+	{
+		return height;
+	}
+
+	bool is_alive() const
+	{
+		return values;
+	}
+
+	const T* get_data() const
+	{
+		return values;
+	}
+
+	float at(int row, int column) const
+	{
+		assert(row >= 0 && row < height);
+		assert(column >= 0 && column < width);
+		return to_float(values[(size_t)row * width + column]);
+	}
+
+	// Float copy, e.g. to train again or to compare with the float kernels
+	matrix to_matrix() const
+	{
+		matrix result(width, height);
+		for (size_t i = 0; i < (size_t)width * height; i++)
+			result.at(i) = to_float(values[i]);
+		return result;
+	}
+};
+
+typedef basic_matrix<float16> half_matrix;
+typedef basic_matrix<bfloat16> bfloat16_matrix;
@@ -0,0 +1,266 @@
+#include "idx_stream.h"
+#include "auxiliary.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static uint32_t read_big_endian(const uint8_t* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+idx_stream::~idx_stream()
+{
+	close();
+}
+
+bool idx_stream::open(const char* images_file_name, const char* labels_file_name, int chunk_samples)
+{
+	assert(chunk_samples > 0);
+
+	close();
+	open_files(images_file_name, labels_file_name);
+
+	// Images: magic 0x0000080D with D dimensions, their sizes, then unsigned bytes. Labels: magic 0x00000801 and the count.
+	uint8_t header[8];
+	if (!read_at(true, 0, header, 4) || read_big_endian(header) >> 8 != 0x08 || (read_big_endian(header) & 0xFF) < 2 ||
+		!read_at(false, 0, header + 4, 4) || read_big_endian(header + 4) != 0x00000801)
+	{
+		close();
+		return false;
+	}
+
+	const int num_dimensions = read_big_endian(header) & 0xFF;
+	std::vector<uint8_t> dimensions(4 * (size_t)num_dimensions);
+	uint8_t labels_count[4];
+	if (!read_at(true, 4, dimensions.data(), dimensions.size()) || !read_at(false, 4, labels_count, 4))
+	{
+		close();
+		return false;
+	}
+
+	num_samples = (int)read_big_endian(dimensions.data());
+	uint64_t size = 1;
+	for (int i = 1; i < num_dimensions; i++)
+		size *= read_big_endian(dimensions.data() + 4 * i);
+
+	if (num_samples <= 0 || size == 0 || size > INT32_MAX || read_big_endian(labels_count) != (uint32_t)num_samples)
+	{
+		close();
+		return false;
+	}
+
+	sample_size = (int)size;
+	images_offset = 4 + dimensions.size();
+	labels_offset = 8;
+
+	this->chunk_samples = std::min(chunk_samples, num_samples);
+	images.resize((size_t)this->chunk_samples * sample_size);
+	labels.resize(this->chunk_samples);
+	chunk_size = 0;
+
+	return true;
+}
+
+#ifdef _WIN32
+
+void idx_stream::open_files(const char* images_file_name, const char* labels_file_name)
+{
+	// Sequential scan makes the cache manager read ahead
+	images_handle = CreateFileA(images_file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	labels_handle = CreateFileA(labels_file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (images_handle == INVALID_HANDLE_VALUE) images_handle = nullptr;
+	if (labels_handle == INVALID_HANDLE_VALUE) labels_handle = nullptr;
+}
+
+void idx_stream::close()
+{
+	if (images_handle) CloseHandle(images_handle);
+	if (labels_handle) CloseHandle(labels_handle);
+	images_handle = nullptr;
+	labels_handle = nullptr;
+
+	num_samples = 0;
+	chunk_size = 0;
+}
+
+bool idx_stream::read_at(bool from_images, uint64_t offset, void* buffer, size_t size) const
+{
+	HANDLE handle = from_images ? images_handle : labels_handle;
+	if (!handle) return false;
+
+	char* destination = static_cast<char*>(buffer);
+	while (size > 0)
+	{
+		OVERLAPPED position = {};
+		position.Offset = (DWORD)offset;
+		position.OffsetHigh = (DWORD)(offset >> 32);
+
+		const DWORD part = (DWORD)std::min<size_t>(size, 1u << 30);
+		DWORD read = 0;
+		if (!ReadFile(handle, destination, part, &read, &position) || read == 0) return false;
+
+		destination += read;
+		offset += read;
+		size -= read;
+	}
+
+	return true;
+}
+
+void idx_stream::prefetch_chunk(int) const
+{
+	// Done by the cache manager, see open_files
+}
+
+#else
+
+void idx_stream::open_files(const char* images_file_name, const char* labels_file_name)
+{
+	images_fd = ::open(images_file_name, O_RDONLY);
+	labels_fd = ::open(labels_file_name, O_RDONLY);
+
+#ifdef POSIX_FADV_RANDOM
+	// Chunks are visited in a random order, reading past the end of one would fetch data that isn't needed next.
+	// Each chunk is read whole and the next one is requested by prefetch_chunk instead.
+	if (images_fd >= 0) posix_fadvise(images_fd, 0, 0, POSIX_FADV_RANDOM);
+	if (labels_fd >= 0) posix_fadvise(labels_fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+}
+
+void idx_stream::close()
+{
+	if (images_fd >= 0) ::close(images_fd);
+	if (labels_fd >= 0) ::close(labels_fd);
+	images_fd = -1;
+	labels_fd = -1;
+
+	num_samples = 0;
+	chunk_size = 0;
+}
+
+bool idx_stream::read_at(bool from_images, uint64_t offset, void* buffer, size_t size) const
+{
+	const int fd = from_images ? images_fd : labels_fd;
+	if (fd < 0) return false;
+
+	char* destination = static_cast<char*>(buffer);
+	while (size > 0)
+	{
+		const ssize_t read = pread(fd, destination, size, (off_t)offset);
+		if (read <= 0) return false;
+
+		destination += read;
+		offset += (uint64_t)read;
+		size -= (size_t)read;
+	}
+
+	return true;
+}
+
+void idx_stream::prefetch_chunk(int index) const
+{
+	assert(index >= 0 && index < get_num_chunks());
+
+#ifdef POSIX_FADV_WILLNEED
+	const int first = index * chunk_samples;
+	const int count = std::min(chunk_samples, num_samples - first);
+	posix_fadvise(images_fd, (off_t)(images_offset + (uint64_t)first * sample_size), (off_t)count * sample_size, POSIX_FADV_WILLNEED);
+	posix_fadvise(labels_fd, (off_t)(labels_offset + first), count, POSIX_FADV_WILLNEED);
+#endif
+}
+
+#endif
+
+bool idx_stream::read_chunk(int index)
+{
+	assert(index >= 0 && index < get_num_chunks());
+
+	const int first = index * chunk_samples;
+	const int count = std::min(chunk_samples, num_samples - first);
+
+	chunk_size = 0;
+	if (!read_at(true, images_offset + (uint64_t)first * sample_size, images.data(), (size_t)count * sample_size) ||
+		!read_at(false, labels_offset + first, labels.data(), count))
+		return false;
+
+	chunk_size = count;
+	return true;
+}
+
+bool train_stream(neural_net& net, idx_stream& stream, int num_epochs, int batch_size, float rate, float pixel_scale,
+	neural_net::training_workspace& ws)
+{
+	assert(stream.get_sample_size() == net.get_input_size());
+	assert(num_epochs > 0);
+	assert(batch_size > 0 && batch_size <= ws.max_batch_size);
+	assert(rate > 0);
+
+	const int num_classes = net.get_output_size();
+	const int sample_size = stream.get_sample_size();
+
+	std::mt19937_64 generator((unsigned long long)random_int(0, INT32_MAX));
+
+	std::vector<int> chunk_order(stream.get_num_chunks());
+	std::iota(chunk_order.begin(), chunk_order.end(), 0);
+	std::vector<int> sample_order;
+
+	// Batches are gathered from the chunk in the shuffled order
+	byte_matrix batch_input(sample_size, batch_size, pixel_scale);
+	matrix batch_required_output(num_classes, batch_size);
+
+	for (int epoch = 0; epoch < num_epochs; epoch++)
+	{
+		std::shuffle(chunk_order.begin(), chunk_order.end(), generator);
+
+		for (size_t c = 0; c < chunk_order.size(); c++)
+		{
+			if (!stream.read_chunk(chunk_order[c])) return false;
+
+			// Read from the disk while this chunk trains
+			if (c + 1 < chunk_order.size())
+				stream.prefetch_chunk(chunk_order[c + 1]);
+
+			const byte_matrix_view images = stream.get_chunk_images(pixel_scale);
+			const int chunk_size = stream.get_chunk_size();
+
+			sample_order.resize(chunk_size);
+			std::iota(sample_order.begin(), sample_order.end(), 0);
+			std::shuffle(sample_order.begin(), sample_order.end(), generator);
+
+			for (int first = 0; first < chunk_size; first += batch_size)
+			{
+				const int count = std::min(batch_size, chunk_size - first);
+
+				for (int i = 0; i < count; i++)
+				{
+					const int sample = sample_order[first + i];
+					memcpy(batch_input.get_data() + (size_t)i * sample_size, images.row(sample), sample_size);
+
+					const int label = stream.get_chunk_label(sample);
+					if (label >= num_classes) return false;
+
+					float* required_row = batch_required_output.get_data() + (size_t)i * num_classes;
+					for (int k = 0; k < num_classes; k++)
+						required_row[k] = 0.f;
+					required_row[label] = 1.f;
+				}
+
+				net.train_batch(batch_input.rows(0, count), batch_required_output.rows(0, count), 1, rate, ws);
+			}
+		}
+	}
+
+	return true;
+}
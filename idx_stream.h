@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "neural_net.h"
+#include "byte_matrix.h"
+
+// IDX images and labels files read in chunks of consecutive samples with positioned reads,
+// for data sets that don't fit in memory. Only the chunk being used is resident, the kernel is told
+// to read ahead the chunk that comes next, so on a warm page cache a read is a copy out of it.
+class idx_stream
+{
+	int num_samples = 0;
+	int sample_size = 0;
+	int chunk_samples = 0;
+
+	uint64_t images_offset = 0;
+	uint64_t labels_offset = 0;
+
+#ifdef _WIN32
+	void* images_handle = nullptr;
+	void* labels_handle = nullptr;
+#else
+	int images_fd = -1;
+	int labels_fd = -1;
+#endif
+
+	// The chunk in memory
+	std::vector<uint8_t> images;
+	std::vector<uint8_t> labels;
+	int chunk_size = 0;
+
+	void open_files(const char* images_file_name, const char* labels_file_name);
+
+	bool read_at(bool from_images, uint64_t offset, void* buffer, size_t size) const;
+
+public:
+	idx_stream() {}
+
+	idx_stream(const idx_stream&) = delete;
+	idx_stream& operator=(const idx_stream&) = delete;
+
+	~idx_stream();
+
+	// Checks the headers of the files, chunk_samples samples are kept in memory at a time
+	bool open(const char* images_file_name, const char* labels_file_name, int chunk_samples);
+
+	void close();
+
+	int get_num_samples() const
+	{
+		return num_samples;
+	}
+
+	int get_sample_size() const
+	{
+		return sample_size;
+	}
+
+	int get_num_chunks() const
+	{
+		return (num_samples + chunk_samples - 1) / chunk_samples;
+	}
+
+	// Reads chunk index into memory, replacing the previous one
+	bool read_chunk(int index);
+
+	// Hints the kernel to start reading chunk index in the background
+	void prefetch_chunk(int index) const;
+
+	// Samples of the chunk in memory, one image per row
+	byte_matrix_view get_chunk_images(float scale) const
+	{
+		return byte_matrix_view(images.data(), sample_size, chunk_size, scale);
+	}
+
+	int get_chunk_size() const
+	{
+		return chunk_size;
+	}
+
+	int get_chunk_label(int index) const
+	{
+		return labels[index];
+	}
+};
+
+// Trains for num_epochs over the whole stream. Every epoch visits the chunks in a random order and
+// the samples of each chunk in a random order, batch_size of them at a time; pixels are scaled by pixel_scale.
+// Returns false if a read fails or a label isn't below the output layer size.
+bool train_stream(neural_net& net, idx_stream& stream, int num_epochs, int batch_size, float rate, float pixel_scale,
+	neural_net::training_workspace& ws);
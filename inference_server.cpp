@@ -0,0 +1,166 @@
+#include "inference_server.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static constexpr double min_latency = 1e-7; // Seconds, the lower bound of the second bucket
+
+static int get_latency_bucket(double latency, int buckets_per_octave, int num_buckets)
+{
+	if (latency <= min_latency) return 0;
+	const int bucket = (int)(std::log2(latency / min_latency) * buckets_per_octave) + 1;
+	return std::min(bucket, num_buckets - 1);
+}
+
+// The geometric middle of the bucket
+static double get_bucket_latency(int bucket, int buckets_per_octave)
+{
+	if (bucket == 0) return min_latency;
+	return min_latency * std::exp2((bucket - 0.5) / buckets_per_octave);
+}
+
+inference_server::inference_server(const neural_net& net, int max_batch_size, clock::duration max_wait)
+	: net(net), max_batch_size(max_batch_size), max_wait(max_wait), session(net, max_batch_size),
+	batch_input((size_t)max_batch_size * net.get_input_size()), batch_output((size_t)max_batch_size * net.get_output_size())
+{
+	assert(max_batch_size > 0);
+
+	statistics_start = clock::now();
+	dispatcher = std::thread(&inference_server::dispatcher_loop, this);
+}
+
+inference_server::~inference_server()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cv.notify_all();
+	dispatcher.join();
+}
+
+std::future<std::vector<float>> inference_server::submit(const float* input)
+{
+	return submit(std::vector<float>(input, input + net.get_input_size()));
+}
+
+std::future<std::vector<float>> inference_server::submit(std::vector<float> input)
+{
+	assert((int)input.size() == net.get_input_size());
+
+	std::future<std::vector<float>> result;
+	bool wake;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		assert(!stop);
+
+		queue.emplace_back();
+		request& r = queue.back();
+		r.input = std::move(input);
+		r.submit_time = clock::now();
+		result = r.result.get_future();
+
+		// The dispatcher waits either for the first request or for a full batch
+		wake = queue.size() == 1 || (int)queue.size() >= max_batch_size;
+	}
+	if (wake) cv.notify_one();
+
+	return result;
+}
+
+void inference_server::dispatcher_loop()
+{
+	std::vector<request> batch;
+	batch.reserve(max_batch_size);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		cv.wait(lock, [&] { return stop || !queue.empty(); });
+		if (queue.empty()) return; // Stopped and drained
+
+		const clock::time_point deadline = queue.front().submit_time + max_wait;
+		cv.wait_until(lock, deadline, [&] { return stop || (int)queue.size() >= max_batch_size; });
+
+		const size_t batch_size = std::min(queue.size(), (size_t)max_batch_size);
+		batch.clear();
+		for (size_t i = 0; i < batch_size; i++)
+		{
+			batch.push_back(std::move(queue.front()));
+			queue.pop_front();
+		}
+
+		lock.unlock();
+		run_batch(batch);
+		lock.lock();
+	}
+}
+
+void inference_server::run_batch(std::vector<request>& batch)
+{
+	const int input_size = net.get_input_size();
+	const int output_size = net.get_output_size();
+
+	for (size_t i = 0; i < batch.size(); i++)
+		memcpy(batch_input.data() + i * input_size, batch[i].input.data(), input_size * sizeof(float));
+
+	session.run(batch_input.data(), batch_output.data(), (int)batch.size());
+
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		const float* row = batch_output.data() + i * output_size;
+		batch[i].result.set_value(std::vector<float>(row, row + output_size));
+	}
+
+	const clock::time_point now = clock::now();
+	std::lock_guard<std::mutex> lock(statistics_mutex);
+	for (const request& r : batch)
+	{
+		const double latency = std::chrono::duration<double>(now - r.submit_time).count();
+		latency_counts[get_latency_bucket(latency, latency_buckets_per_octave, num_latency_buckets)]++;
+	}
+	num_requests += batch.size();
+	num_batches++;
+}
+
+inference_server::statistics inference_server::get_statistics() const
+{
+	std::lock_guard<std::mutex> lock(statistics_mutex);
+
+	statistics result;
+	result.requests = num_requests;
+	result.batches = num_batches;
+	if (num_requests == 0) return result;
+
+	result.mean_batch_size = (double)num_requests / num_batches;
+	result.throughput = num_requests / std::chrono::duration<double>(clock::now() - statistics_start).count();
+
+	// The buckets holding the requests of rank (n - 1) / 2 and (n - 1) * 99 / 100 in latency order
+	const size_t p50_rank = (num_requests - 1) / 2;
+	const size_t p99_rank = (num_requests - 1) * 99 / 100;
+	size_t count = 0;
+	for (int i = 0; i < num_latency_buckets; i++)
+	{
+		const size_t previous_count = count;
+		count += latency_counts[i];
+		if (previous_count <= p50_rank && p50_rank < count)
+			result.p50_latency = get_bucket_latency(i, latency_buckets_per_octave);
+		if (previous_count <= p99_rank && p99_rank < count)
+		{
+			result.p99_latency = get_bucket_latency(i, latency_buckets_per_octave);
+			break;
+		}
+	}
+
+	return result;
+}
+
+void inference_server::reset_statistics()
+{
+	std::lock_guard<std::mutex> lock(statistics_mutex);
+	latency_counts.fill(0);
+	num_requests = 0;
+	num_batches = 0;
+	statistics_start = clock::now();
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <deque>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "neural_net.h"
+#include "inference_session.h"
+
+// In-process batching front end for serving a network from many threads.
+// Callers submit single samples and get a future of the output row. A dispatcher thread gathers
+// the waiting requests into one batch, up to max_batch_size rows or until the oldest request has waited
+// max_wait, runs the network once over the batch with its inference_session and hands every caller its row.
+class inference_server
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct statistics
+	{
+		size_t requests = 0;
+		size_t batches = 0;
+		double mean_batch_size = 0;
+		double throughput = 0; // Requests per second since the start or the last reset
+		double p50_latency = 0; // Seconds from submit to the result being set
+		double p99_latency = 0;
+	};
+
+private:
+	struct request
+	{
+		std::vector<float> input;
+		std::promise<std::vector<float>> result;
+		clock::time_point submit_time;
+	};
+
+	const neural_net& net;
+	int max_batch_size;
+	clock::duration max_wait;
+
+	// Used by the dispatcher only
+	inference_session session;
+	std::vector<float> batch_input;
+	std::vector<float> batch_output;
+
+	std::thread dispatcher;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<request> queue;
+	bool stop = false;
+
+	// Latencies are counted in buckets 2^(1/8) apart from 100 ns to about 100 s, longer ones go in the last bucket.
+	// The statistics take the same memory however many requests they cover, and percentiles are within 5%.
+	static constexpr int latency_buckets_per_octave = 8;
+	static constexpr int num_latency_buckets = 30 * latency_buckets_per_octave;
+
+	mutable std::mutex statistics_mutex;
+	std::array<size_t, num_latency_buckets> latency_counts{};
+	size_t num_requests = 0;
+	size_t num_batches = 0;
+	clock::time_point statistics_start;
+
+	void dispatcher_loop();
+
+	void run_batch(std::vector<request>& batch);
+
+public:
+	inference_server(const neural_net& net, int max_batch_size = 64, clock::duration max_wait = std::chrono::microseconds(500));
+
+	inference_server(const inference_server&) = delete;
+	inference_server& operator=(const inference_server&) = delete;
+
+	// Finishes the queued requests before returning
+	~inference_server();
+
+	// input holds get_input_size() values of the network
+	std::future<std::vector<float>> submit(const float* input);
+
+	std::future<std::vector<float>> submit(std::vector<float> input);
+
+	statistics get_statistics() const;
+
+	void reset_statistics();
+};
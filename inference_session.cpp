@@ -0,0 +1,32 @@
+#include "inference_session.h"
+
+#include <algorithm>
+
+inference_session::inference_session(const neural_net& net, int max_batch_size) : net(net), max_batch_size(max_batch_size)
+{
+	assert(max_batch_size > 0);
+
+	int max_hidden_size = 1;
+	for (int i = 0; i + 1 < net.get_num_layers(); i++)
+		max_hidden_size = std::max(max_hidden_size, net.get_layer_size(i));
+
+	buffers[0] = matrix(max_hidden_size, max_batch_size);
+	buffers[1] = matrix(max_hidden_size, max_batch_size);
+}
+
+void inference_session::run(const float* in, float* out, int rows)
+{
+	assert(in && out);
+	assert(rows > 0 && rows <= max_batch_size);
+
+	const int num_layers = net.get_num_layers();
+
+	for (int i = 0; i < num_layers; i++)
+	{
+		const float* layer_input = i == 0 ? in : buffers[(i - 1) & 1].get_data();
+		float* layer_output = i == num_layers - 1 ? out : buffers[i & 1].get_data();
+
+		const int layer_input_size = i == 0 ? net.get_input_size() : net.get_layer_size(i - 1);
+		net.run_layer(i, matrix_view(layer_input, layer_input_size, rows), layer_output);
+	}
+}
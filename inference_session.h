@@ -0,0 +1,24 @@
+#pragma once
+#include "neural_net.h"
+
+// Preallocated scratch for running a network, so that repeated calls don't allocate.
+// The session only reads the network, so many sessions, one per thread, can share one model.
+// The network must outlive its sessions and must not be trained while they run.
+class inference_session
+{
+	const neural_net& net;
+	int max_batch_size;
+	matrix buffers[2]; // Hidden layer activations, layers alternate between the two
+
+public:
+	inference_session(const neural_net& net, int max_batch_size);
+
+	int get_max_batch_size() const
+	{
+		return max_batch_size;
+	}
+
+	// in holds rows x net.get_input_size() values, out receives rows x net.get_output_size() values.
+	// The first layer reads in and the last layer writes out directly.
+	void run(const float* in, float* out, int rows);
+};
@@ -0,0 +1,55 @@
+#include "kernels.h"
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#endif
+
+const kernel_table* get_kernels(instruction_set isa)
+{
+	static const instruction_set supported = detect_instruction_set();
+
+	if (isa > supported) return nullptr;
+
+	switch (isa)
+	{
+	case instruction_set::scalar:
+		return &scalar_kernels;
+#ifdef KERNELS_X86
+	case instruction_set::sse2:
+		return &sse2_kernels;
+	case instruction_set::avx2:
+		return &avx2_kernels;
+	case instruction_set::avx512:
+		return &avx512_kernels;
+#endif
+	default:
+		return nullptr;
+	}
+}
+
+static const kernel_table& select_kernels()
+{
+	instruction_set isa = detect_instruction_set();
+
+	instruction_set requested;
+	if (const char* env = std::getenv("SNN_ISA"))
+	{
+		if (parse_instruction_set(env, requested) && requested < isa)
+			isa = requested;
+	}
+
+	// Fall back to the next lower set if this one is not compiled in
+	for (;;)
+	{
+		if (const kernel_table* table = get_kernels(isa))
+			return *table;
+		isa = (instruction_set)((int)isa - 1);
+	}
+}
+
+const kernel_table& kernels()
+{
+	static const kernel_table& selected = select_kernels();
+	return selected;
+}
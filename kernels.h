@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_features.h"
+#include "gemm.h"
+#include "half.h"
+
+// Set of the innermost matrix kernels compiled for one instruction set.
+// The best set the CPU supports is chosen once, the SNN_ISA environment variable
+// (scalar, sse2, avx2 or avx512) can force a lower one.
+struct kernel_table
+{
+	instruction_set isa;
+
+	// Tile size of the GEMM microkernel, NR is a multiple of the vector width
+	int gemm_mr;
+	int gemm_nr;
+
+	// Computes an mr x nr tile of C from a packed MR x kc panel of A and a packed kc x NR panel of B.
+	// The tile overwrites C unless accumulate is set. The epilogue is only passed for the last k block.
+	void (*gemm_micro_kernel)(int kc, const float* a, const float* b, float* c, size_t ldc, int mr, int nr, bool accumulate,
+		const gemm_epilogue* epilogue);
+
+	// Row vector times matrix for single-sample layers: y = f(x * B + bias) for a k-vector x and a k x n matrix B.
+	// Every row of B is streamed once, with the columns of y accumulated in registers.
+	void (*gemv)(int n, int k, const float* x, const float* b, size_t ldb, float* y, const gemm_epilogue* epilogue);
+
+	// Same with B stored in 16 bits, every vector of B is converted to floats in registers as it is loaded
+	void (*gemv_f16)(int n, int k, const float* x, const float16* b, size_t ldb, float* y, const gemm_epilogue* epilogue);
+	void (*gemv_bf16)(int n, int k, const float* x, const bfloat16* b, size_t ldb, float* y, const gemm_epilogue* epilogue);
+
+	// Applies the activation function to count values in place
+	void (*activate)(activation f, float* values, size_t count);
+
+	// Writes the transpose of a rows x columns block of source into destination
+	void (*transpose)(const float* source, size_t source_stride, float* destination, size_t destination_stride, int rows, int columns);
+
+	// y = alpha * x + beta * y
+	void (*axpby)(size_t count, float alpha, const float* x, float beta, float* y);
+
+	// Integer GEMM for quantized layers: C = A * B^T with 32-bit sums, for an m x k matrix A and an n x k matrix B
+	// of int8 values in [-127, 127]. B holds the weights of one output per row, so both operands are read along k.
+	void (*gemm_s8)(int m, int n, int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc);
+
+	// y = x * inverse_scale rounded to the nearest integer, ties to even, and clamped to [-127, 127]
+	void (*quantize_s8)(size_t count, float inverse_scale, const float* x, int8_t* y);
+};
+
+// Kernels selected for this process
+const kernel_table& kernels();
+
+// Kernels for the given instruction set, or null if they are not compiled in or not supported by the CPU
+const kernel_table* get_kernels(instruction_set isa);
+
+extern const kernel_table scalar_kernels;
+extern const kernel_table sse2_kernels;
+extern const kernel_table avx2_kernels;
+extern const kernel_table avx512_kernels;
@@ -0,0 +1,53 @@
+// Helpers shared by the AVX2 and AVX-512 kernels, included after the instruction set is enabled
+
+namespace
+{
+	// Transposes an 8 x 8 block of floats
+	inline void transpose_8x8(const float* source, size_t source_stride, float* destination, size_t destination_stride)
+	{
+		__m256 r0 = _mm256_loadu_ps(source);
+		__m256 r1 = _mm256_loadu_ps(source + source_stride);
+		__m256 r2 = _mm256_loadu_ps(source + 2 * source_stride);
+		__m256 r3 = _mm256_loadu_ps(source + 3 * source_stride);
+		__m256 r4 = _mm256_loadu_ps(source + 4 * source_stride);
+		__m256 r5 = _mm256_loadu_ps(source + 5 * source_stride);
+		__m256 r6 = _mm256_loadu_ps(source + 6 * source_stride);
+		__m256 r7 = _mm256_loadu_ps(source + 7 * source_stride);
+
+		const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+		const __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+		const __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+		const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+		const __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+		const __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+		const __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+		const __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+		const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		const __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		const __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+		const __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+		r0 = _mm256_permute2f128_ps(s0, s4, 0x20);
+		r1 = _mm256_permute2f128_ps(s1, s5, 0x20);
+		r2 = _mm256_permute2f128_ps(s2, s6, 0x20);
+		r3 = _mm256_permute2f128_ps(s3, s7, 0x20);
+		r4 = _mm256_permute2f128_ps(s0, s4, 0x31);
+		r5 = _mm256_permute2f128_ps(s1, s5, 0x31);
+		r6 = _mm256_permute2f128_ps(s2, s6, 0x31);
+		r7 = _mm256_permute2f128_ps(s3, s7, 0x31);
+
+		_mm256_storeu_ps(destination, r0);
+		_mm256_storeu_ps(destination + destination_stride, r1);
+		_mm256_storeu_ps(destination + 2 * destination_stride, r2);
+		_mm256_storeu_ps(destination + 3 * destination_stride, r3);
+		_mm256_storeu_ps(destination + 4 * destination_stride, r4);
+		_mm256_storeu_ps(destination + 5 * destination_stride, r5);
+		_mm256_storeu_ps(destination + 6 * destination_stride, r6);
+		_mm256_storeu_ps(destination + 7 * destination_stride, r7);
+	}
+}
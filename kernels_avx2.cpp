@@ -0,0 +1,70 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+#include "kernels_avx.h"
+
+namespace
+{
+	struct simd
+	{
+		typedef __m256 type;
+		static constexpr int width = 8;
+		static constexpr int transpose_tile_size = 8;
+
+		static type zero() { return _mm256_setzero_ps(); }
+		static type set1(float v) { return _mm256_set1_ps(v); }
+		static type load(const float* p) { return _mm256_loadu_ps(p); }
+		static type load(const float16* p) { return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+		static type load(const bfloat16* p)
+		{
+			return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))), 16));
+		}
+		static void store(float* p, type v) { _mm256_storeu_ps(p, v); }
+		static type add(type a, type b) { return _mm256_add_ps(a, b); }
+		static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+		static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+		static type div(type a, type b) { return _mm256_div_ps(a, b); }
+		static type fmadd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+		static type min(type a, type b) { return _mm256_min_ps(a, b); }
+		static type max(type a, type b) { return _mm256_max_ps(a, b); }
+		static type round(type v) { return _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+		static type select_less(type a, type b, type x, type y) { return _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+
+		static type pow2n(type n)
+		{
+			return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+		}
+
+		static void transpose_tile(const float* source, size_t source_stride, float* destination, size_t destination_stride)
+		{
+			transpose_8x8(source, source_stride, destination, destination_stride);
+		}
+	};
+}
+
+#define KERNEL_MR 6
+#define KERNEL_NR 16
+#include "kernels_impl.h"
+#include "kernels_avx_s8.h"
+
+const kernel_table avx2_kernels = { instruction_set::avx2, KERNEL_MR, KERNEL_NR, gemm_micro_kernel, gemv_kernel<float>, gemv_kernel<float16>, gemv_kernel<bfloat16>,
+	activate_kernel, transpose_kernel, axpby_kernel, gemm_s8_kernel, quantize_s8_kernel };
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx2,fma,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma,f16c")
+// The intrinsics start from _mm512_undefined_ps(), which GCC reports as uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include "kernels_avx.h"
+
+namespace
+{
+	struct simd
+	{
+		typedef __m512 type;
+		static constexpr int width = 16;
+		static constexpr int transpose_tile_size = 8;
+
+		static type zero() { return _mm512_setzero_ps(); }
+		static type set1(float v) { return _mm512_set1_ps(v); }
+		static type load(const float* p) { return _mm512_loadu_ps(p); }
+		static type load(const float16* p) { return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))); }
+		static type load(const bfloat16* p)
+		{
+			return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))), 16));
+		}
+		static void store(float* p, type v) { _mm512_storeu_ps(p, v); }
+		static type add(type a, type b) { return _mm512_add_ps(a, b); }
+		static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+		static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+		static type div(type a, type b) { return _mm512_div_ps(a, b); }
+		static type fmadd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+		static type min(type a, type b) { return _mm512_min_ps(a, b); }
+		static type max(type a, type b) { return _mm512_max_ps(a, b); }
+		static type round(type v) { return _mm512_roundscale_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+		static type select_less(type a, type b, type x, type y) { return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), y, x); }
+
+		static type pow2n(type n)
+		{
+			return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23));
+		}
+
+		static void transpose_tile(const float* source, size_t source_stride, float* destination, size_t destination_stride)
+		{
+			transpose_8x8(source, source_stride, destination, destination_stride);
+		}
+	};
+}
+
+#define KERNEL_MR 12
+#define KERNEL_NR 32
+#include "kernels_impl.h"
+#include "kernels_avx_s8.h"
+
+const kernel_table avx512_kernels = { instruction_set::avx512, KERNEL_MR, KERNEL_NR, gemm_micro_kernel, gemv_kernel<float>, gemv_kernel<float16>, gemv_kernel<bfloat16>,
+	activate_kernel, transpose_kernel, axpby_kernel, gemm_s8_kernel, quantize_s8_kernel };
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+#endif
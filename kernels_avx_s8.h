@@ -0,0 +1,123 @@
+// Int8 GEMM shared by the AVX2 and AVX-512 kernels, included after kernels_impl.h
+
+namespace
+{
+	// Adds the products of 32 pairs of int8 values in [-127, 127] to the 8 lanes of sum, abs_a being the absolute values of a.
+	// maddubs takes one unsigned operand, so the sign of a moves onto b; |a| * |b| <= 127 * 127 keeps the sums of pairs in 16 bits.
+	inline __m256i dot_s8(__m256i sum, __m256i abs_a, __m256i a, __m256i b)
+	{
+		const __m256i pairs = _mm256_maddubs_epi16(abs_a, _mm256_sign_epi8(b, a));
+		return _mm256_add_epi32(sum, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+	}
+
+	// Sums of the lanes of four vectors
+	inline __m128i reduce_4x8(__m256i s0, __m256i s1, __m256i s2, __m256i s3)
+	{
+		const __m256i sums = _mm256_hadd_epi32(_mm256_hadd_epi32(s0, s1), _mm256_hadd_epi32(s2, s3));
+		return _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+	}
+
+	// R rows of A times C <= 4 rows of B, every vector of B is loaded once for all rows of A
+	template<int R, int C>
+	void gemm_s8_block(int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc)
+	{
+		__m256i sums[R][4];
+		KERNEL_UNROLL
+		for (int r = 0; r < R; r++)
+		{
+			KERNEL_UNROLL
+			for (int j = 0; j < 4; j++)
+				sums[r][j] = _mm256_setzero_si256();
+		}
+
+		int p = 0;
+		for (; p + 32 <= k; p += 32)
+		{
+			__m256i b_values[C];
+			KERNEL_UNROLL
+			for (int j = 0; j < C; j++)
+				b_values[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + (size_t)j * ldb + p));
+
+			KERNEL_UNROLL
+			for (int r = 0; r < R; r++)
+			{
+				const __m256i a_values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + (size_t)r * lda + p));
+				const __m256i abs_a = _mm256_abs_epi8(a_values);
+				KERNEL_UNROLL
+				for (int j = 0; j < C; j++)
+					sums[r][j] = dot_s8(sums[r][j], abs_a, a_values, b_values[j]);
+			}
+		}
+
+		KERNEL_UNROLL
+		for (int r = 0; r < R; r++)
+		{
+			alignas(16) int32_t totals[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(totals), reduce_4x8(sums[r][0], sums[r][1], sums[r][2], sums[r][3]));
+
+			for (int j = 0; j < C; j++)
+			{
+				int32_t sum = totals[j];
+				for (int q = p; q < k; q++)
+					sum += (int32_t)a[(size_t)r * lda + q] * b[(size_t)j * ldb + q];
+				c[(size_t)r * ldc + j] = sum;
+			}
+		}
+	}
+
+	template<int R>
+	void gemm_s8_rows(int n, int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc)
+	{
+		int j = 0;
+		for (; j + 4 <= n; j += 4)
+			gemm_s8_block<R, 4>(k, a, lda, b + (size_t)j * ldb, ldb, c + j, ldc);
+
+		switch (n - j)
+		{
+		case 3:
+			gemm_s8_block<R, 3>(k, a, lda, b + (size_t)j * ldb, ldb, c + j, ldc);
+			break;
+		case 2:
+			gemm_s8_block<R, 2>(k, a, lda, b + (size_t)j * ldb, ldb, c + j, ldc);
+			break;
+		case 1:
+			gemm_s8_block<R, 1>(k, a, lda, b + (size_t)j * ldb, ldb, c + j, ldc);
+			break;
+		}
+	}
+
+	// AVX2 even in the AVX-512 set, its byte and word instructions need AVX512BW, which isn't detected
+	void gemm_s8_kernel(int m, int n, int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc)
+	{
+		int i = 0;
+		for (; i + 2 <= m; i += 2)
+			gemm_s8_rows<2>(n, k, a + (size_t)i * lda, lda, b, ldb, c + (size_t)i * ldc, ldc);
+		if (i < m)
+			gemm_s8_rows<1>(n, k, a + (size_t)i * lda, lda, b, ldb, c + (size_t)i * ldc, ldc);
+	}
+
+	void quantize_s8_kernel(size_t count, float inverse_scale, const float* x, int8_t* y)
+	{
+		const __m256 scale = _mm256_set1_ps(inverse_scale);
+		const __m256 low = _mm256_set1_ps(-127.f);
+		const __m256 high = _mm256_set1_ps(127.f);
+
+		// The packs work within 128-bit lanes, which leaves the 4-byte groups of the result in this order
+		const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+		size_t i = 0;
+		for (; i + 32 <= count; i += 32)
+		{
+			__m256i q[4];
+			KERNEL_UNROLL
+			for (int v = 0; v < 4; v++)
+				q[v] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i + 8 * v), scale), low), high));
+
+			const __m256i bytes = _mm256_packs_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), _mm256_permutevar8x32_epi32(bytes, order));
+		}
+
+		for (; i < count; i++)
+			y[i] = (int8_t)std::lrint(std::min(std::max(x[i] * inverse_scale, -127.f), 127.f));
+	}
+}
@@ -0,0 +1,363 @@
+// Implementation of the kernel table shared by all instruction sets.
+// It is included by the kernels_*.cpp files after they define:
+//   struct simd - vector type and operations, see kernels_scalar.cpp for the list
+//   KERNEL_MR, KERNEL_NR - GEMM microkernel tile size, KERNEL_NR must be a multiple of simd::width
+// and after they enable code generation for their instruction set, so everything here is compiled for it.
+// The functions have internal linkage, so the variants don't clash when linked together.
+
+// Also used by the integer kernels each file adds after including this one
+#if defined(__clang__)
+#define KERNEL_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define KERNEL_UNROLL _Pragma("GCC unroll 32")
+#else
+#define KERNEL_UNROLL
+#endif
+
+namespace
+{
+	typedef simd::type vec;
+
+	constexpr int W = simd::width;
+
+	// Exponent with a relative error below 2e-7 in the range [-87, 88], based on the Cephes expf.
+	// x = n * ln(2) + r with |r| <= ln(2) / 2, then e^x = 2^n * P(r) with a degree 7 polynomial.
+	inline vec exp_vector(vec x)
+	{
+		x = simd::min(simd::max(x, simd::set1(-87.3f)), simd::set1(88.3f));
+
+		const vec n = simd::round(simd::mul(x, simd::set1(1.44269504088896341f)));
+		vec r = simd::fmadd(n, simd::set1(-0.693359375f), x);
+		r = simd::fmadd(n, simd::set1(2.12194440e-4f), r);
+
+		vec p = simd::set1(1.9875691500e-4f);
+		p = simd::fmadd(p, r, simd::set1(1.3981999507e-3f));
+		p = simd::fmadd(p, r, simd::set1(8.3334519073e-3f));
+		p = simd::fmadd(p, r, simd::set1(4.1665795894e-2f));
+		p = simd::fmadd(p, r, simd::set1(1.6666665459e-1f));
+		p = simd::fmadd(p, r, simd::set1(5.0000001201e-1f));
+		p = simd::fmadd(p, simd::mul(r, r), simd::add(r, simd::set1(1.f)));
+
+		return simd::mul(p, simd::pow2n(n));
+	}
+
+	inline vec sigmoid(vec x)
+	{
+		const vec one = simd::set1(1.f);
+		return simd::div(one, simd::add(one, exp_vector(simd::sub(simd::zero(), x))));
+	}
+
+	inline vec relu(vec x)
+	{
+		return simd::max(x, simd::zero());
+	}
+
+	// Cephes tanhf: an odd polynomial below 0.625, where 1 - 2 / (e^2x + 1) would lose precision, and the exponent above
+	inline vec tanh(vec x)
+	{
+		const vec zero = simd::zero();
+		const vec one = simd::set1(1.f);
+		const vec a = simd::max(x, simd::sub(zero, x));
+
+		const vec z = simd::mul(x, x);
+		vec p = simd::set1(-5.70498872745e-3f);
+		p = simd::fmadd(p, z, simd::set1(2.06390887954e-2f));
+		p = simd::fmadd(p, z, simd::set1(-5.37397155531e-2f));
+		p = simd::fmadd(p, z, simd::set1(1.33314422036e-1f));
+		p = simd::fmadd(p, z, simd::set1(-3.33332819422e-1f));
+		const vec small = simd::fmadd(simd::mul(p, z), x, x);
+
+		vec large = simd::sub(one, simd::div(simd::set1(2.f), simd::add(exp_vector(simd::add(a, a)), one)));
+		large = simd::select_less(x, zero, simd::sub(zero, large), large);
+
+		return simd::select_less(a, simd::set1(0.625f), small, large);
+	}
+
+	// Element-wise activations only, softmax is handled on whole rows
+	inline vec activate_vector(activation f, vec x)
+	{
+		switch (f)
+		{
+		case activation::sigmoid:
+			return sigmoid(x);
+		case activation::relu:
+			return relu(x);
+		case activation::tanh:
+			return tanh(x);
+		default:
+			return x;
+		}
+	}
+
+	// Applies f to count values, the tail is processed in a zero padded vector
+	template<typename F>
+	void map_values(float* values, size_t count, F f)
+	{
+		size_t i = 0;
+		for (; i + W <= count; i += W)
+			simd::store(values + i, f(simd::load(values + i)));
+
+		if (i < count)
+		{
+			float tail[W] = {};
+			for (size_t j = i; j < count; j++)
+				tail[j - i] = values[j];
+			simd::store(tail, f(simd::load(tail)));
+			for (size_t j = i; j < count; j++)
+				values[j] = tail[j - i];
+		}
+	}
+
+	// Function objects for map_values, so that every call is compiled for this instruction set
+	struct sigmoid_function
+	{
+		vec operator()(vec x) const { return sigmoid(x); }
+	};
+
+	struct relu_function
+	{
+		vec operator()(vec x) const { return relu(x); }
+	};
+
+	struct tanh_function
+	{
+		vec operator()(vec x) const { return tanh(x); }
+	};
+
+	struct shifted_exp_function
+	{
+		vec shift;
+		vec operator()(vec x) const { return exp_vector(simd::sub(x, shift)); }
+	};
+
+	struct scale_function
+	{
+		vec scale;
+		vec operator()(vec x) const { return simd::mul(x, scale); }
+	};
+
+	// Softmax of one row, shifted by its maximum so that exp can't overflow
+	void softmax(float* values, size_t count)
+	{
+		if (count == 0) return;
+
+		float max_value = values[0];
+		for (size_t i = 1; i < count; i++)
+			max_value = values[i] > max_value ? values[i] : max_value;
+
+		map_values(values, count, shifted_exp_function{ simd::set1(max_value) });
+
+		float sum = 0.f;
+		for (size_t i = 0; i < count; i++)
+			sum += values[i];
+
+		map_values(values, count, scale_function{ simd::set1(1.f / sum) });
+	}
+
+	void activate_kernel(activation f, float* values, size_t count)
+	{
+		switch (f)
+		{
+		case activation::linear:
+			break;
+		case activation::sigmoid:
+			map_values(values, count, sigmoid_function());
+			break;
+		case activation::relu:
+			map_values(values, count, relu_function());
+			break;
+		case activation::tanh:
+			map_values(values, count, tanh_function());
+			break;
+		case activation::softmax:
+			softmax(values, count);
+			break;
+		}
+	}
+
+	void gemm_micro_kernel(int kc, const float* a, const float* b, float* c, size_t ldc, int mr, int nr, bool accumulate,
+		const gemm_epilogue* epilogue)
+	{
+		constexpr int MR = KERNEL_MR;
+		constexpr int NV = KERNEL_NR / W;
+
+		vec acc[MR][NV];
+		KERNEL_UNROLL
+		for (int i = 0; i < MR; i++)
+		{
+			KERNEL_UNROLL
+			for (int v = 0; v < NV; v++)
+				acc[i][v] = simd::zero();
+		}
+
+		for (int p = 0; p < kc; p++)
+		{
+			vec b_values[NV];
+			KERNEL_UNROLL
+			for (int v = 0; v < NV; v++)
+				b_values[v] = simd::load(b + v * W);
+
+			KERNEL_UNROLL
+			for (int i = 0; i < MR; i++)
+			{
+				const vec a_value = simd::set1(a[i]);
+				KERNEL_UNROLL
+				for (int v = 0; v < NV; v++)
+					acc[i][v] = simd::fmadd(a_value, b_values[v], acc[i][v]);
+			}
+
+			a += MR;
+			b += KERNEL_NR;
+		}
+
+		if (mr == MR && nr == KERNEL_NR)
+		{
+			// Full tile: the epilogue works on the accumulators directly
+			KERNEL_UNROLL
+			for (int i = 0; i < MR; i++)
+			{
+				float* c_row = c + (size_t)i * ldc;
+				KERNEL_UNROLL
+				for (int v = 0; v < NV; v++)
+				{
+					vec result = acc[i][v];
+					if (accumulate)
+						result = simd::add(result, simd::load(c_row + v * W));
+					if (epilogue)
+					{
+						if (epilogue->bias)
+							result = simd::add(result, simd::load(epilogue->bias + v * W));
+						result = activate_vector(epilogue->f, result);
+					}
+					simd::store(c_row + v * W, result);
+				}
+			}
+			return;
+		}
+
+		// Edge tile: finish the rows in a local buffer and copy the valid part
+		float tile[KERNEL_NR];
+		for (int i = 0; i < mr; i++)
+		{
+			float* c_row = c + (size_t)i * ldc;
+
+			for (int v = 0; v < NV; v++)
+				simd::store(tile + v * W, acc[i][v]);
+
+			for (int j = 0; j < nr; j++)
+			{
+				if (accumulate)
+					tile[j] += c_row[j];
+				if (epilogue && epilogue->bias)
+					tile[j] += epilogue->bias[j];
+			}
+
+			if (epilogue)
+				activate_kernel(epilogue->f, tile, nr);
+
+			for (int j = 0; j < nr; j++)
+				c_row[j] = tile[j];
+		}
+	}
+
+	// Columns [j, j + V * W) of the vector-matrix product, V vectors of accumulators live through the whole k loop
+	// B may be stored in 16 bits, simd::load converts it
+	template<int V, typename T>
+	void gemv_block(int j, int k, const float* x, const T* b, size_t ldb, float* y, const gemm_epilogue* epilogue)
+	{
+		vec acc[V];
+		KERNEL_UNROLL
+		for (int v = 0; v < V; v++)
+			acc[v] = simd::zero();
+
+		const T* column = b + j;
+		for (int p = 0; p < k; p++)
+		{
+			const vec x_value = simd::set1(x[p]);
+			KERNEL_UNROLL
+			for (int v = 0; v < V; v++)
+				acc[v] = simd::fmadd(x_value, simd::load(column + v * W), acc[v]);
+			column += ldb;
+		}
+
+		KERNEL_UNROLL
+		for (int v = 0; v < V; v++)
+		{
+			vec result = acc[v];
+			if (epilogue)
+			{
+				if (epilogue->bias)
+					result = simd::add(result, simd::load(epilogue->bias + j + v * W));
+				result = activate_vector(epilogue->f, result);
+			}
+			simd::store(y + j + v * W, result);
+		}
+	}
+
+	template<typename T>
+	void gemv_kernel(int n, int k, const float* x, const T* b, size_t ldb, float* y, const gemm_epilogue* epilogue)
+	{
+		constexpr int V = 4;
+
+		int j = 0;
+		for (; j + V * W <= n; j += V * W)
+			gemv_block<V>(j, k, x, b, ldb, y, epilogue);
+		for (; j + W <= n; j += W)
+			gemv_block<1>(j, k, x, b, ldb, y, epilogue);
+
+		if (j < n)
+		{
+			// Tail columns, the rows of B are too short for a full vector
+			float tail[W];
+			for (int c = j; c < n; c++)
+			{
+				float sum = 0.f;
+				for (int p = 0; p < k; p++)
+					sum += x[p] * to_float(b[(size_t)p * ldb + c]);
+				tail[c - j] = sum + (epilogue && epilogue->bias ? epilogue->bias[c] : 0.f);
+			}
+			if (epilogue)
+				activate_kernel(epilogue->f, tail, n - j);
+			for (int c = j; c < n; c++)
+				y[c] = tail[c - j];
+		}
+	}
+
+	void transpose_kernel(const float* source, size_t source_stride, float* destination, size_t destination_stride, int rows, int columns)
+	{
+		constexpr int T = simd::transpose_tile_size;
+
+		int i = 0;
+		for (; i + T <= rows; i += T)
+		{
+			int j = 0;
+			for (; j + T <= columns; j += T)
+				simd::transpose_tile(source + (size_t)i * source_stride + j, source_stride, destination + (size_t)j * destination_stride + i, destination_stride);
+
+			for (; j < columns; j++)
+			{
+				for (int r = i; r < i + T; r++)
+					destination[(size_t)j * destination_stride + r] = source[(size_t)r * source_stride + j];
+			}
+		}
+
+		for (; i < rows; i++)
+		{
+			for (int j = 0; j < columns; j++)
+				destination[(size_t)j * destination_stride + i] = source[(size_t)i * source_stride + j];
+		}
+	}
+
+	void axpby_kernel(size_t count, float alpha, const float* x, float beta, float* y)
+	{
+		const vec alpha_vector = simd::set1(alpha);
+		const vec beta_vector = simd::set1(beta);
+
+		size_t i = 0;
+		for (; i + W <= count; i += W)
+			simd::store(y + i, simd::fmadd(alpha_vector, simd::load(x + i), simd::mul(beta_vector, simd::load(y + i))));
+
+		for (; i < count; i++)
+			y[i] = alpha * x[i] + beta * y[i];
+	}
+}
@@ -0,0 +1,80 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+// Portable fallback, a vector of one float
+namespace
+{
+	struct simd
+	{
+		typedef float type;
+		static constexpr int width = 1;
+		static constexpr int transpose_tile_size = 1;
+
+		static type zero() { return 0.f; }
+		static type set1(float v) { return v; }
+		static type load(const float* p) { return *p; }
+		static type load(const float16* p) { return to_float(*p); }
+		static type load(const bfloat16* p) { return to_float(*p); }
+		static void store(float* p, type v) { *p = v; }
+		static type add(type a, type b) { return a + b; }
+		static type sub(type a, type b) { return a - b; }
+		static type mul(type a, type b) { return a * b; }
+		static type div(type a, type b) { return a / b; }
+		static type fmadd(type a, type b, type c) { return a * b + c; }
+		static type min(type a, type b) { return a < b ? a : b; }
+		static type max(type a, type b) { return a > b ? a : b; }
+		static type round(type v) { return std::nearbyint(v); }
+		// Per lane a < b ? x : y
+		static type select_less(type a, type b, type x, type y) { return a < b ? x : y; }
+
+		// 2^n for integral n in [-126, 127]
+		static type pow2n(type n)
+		{
+			const uint32_t bits = (uint32_t)((int32_t)n + 127) << 23;
+			float result;
+			memcpy(&result, &bits, sizeof(result));
+			return result;
+		}
+
+		static void transpose_tile(const float* source, size_t, float* destination, size_t)
+		{
+			*destination = *source;
+		}
+	};
+}
+
+#define KERNEL_MR 4
+#define KERNEL_NR 8
+#include "kernels_impl.h"
+
+namespace
+{
+	void gemm_s8_kernel(int m, int n, int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc)
+	{
+		for (int i = 0; i < m; i++)
+		{
+			for (int j = 0; j < n; j++)
+			{
+				const int8_t* a_row = a + (size_t)i * lda;
+				const int8_t* b_row = b + (size_t)j * ldb;
+
+				int32_t sum = 0;
+				for (int p = 0; p < k; p++)
+					sum += (int32_t)a_row[p] * b_row[p];
+				c[(size_t)i * ldc + j] = sum;
+			}
+		}
+	}
+
+	void quantize_s8_kernel(size_t count, float inverse_scale, const float* x, int8_t* y)
+	{
+		for (size_t i = 0; i < count; i++)
+			y[i] = (int8_t)std::lrint(std::min(std::max(x[i] * inverse_scale, -127.f), 127.f));
+	}
+}
+
+const kernel_table scalar_kernels = { instruction_set::scalar, KERNEL_MR, KERNEL_NR, gemm_micro_kernel, gemv_kernel<float>, gemv_kernel<float16>, gemv_kernel<bfloat16>,
+	activate_kernel, transpose_kernel, axpby_kernel, gemm_s8_kernel, quantize_s8_kernel };
@@ -0,0 +1,181 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+namespace
+{
+	struct simd
+	{
+		typedef __m128 type;
+		static constexpr int width = 4;
+		static constexpr int transpose_tile_size = 4;
+
+		static type zero() { return _mm_setzero_ps(); }
+		static type set1(float v) { return _mm_set1_ps(v); }
+		static type load(const float* p) { return _mm_loadu_ps(p); }
+		// No half conversion instructions before F16C
+		static type load(const float16* p) { return _mm_setr_ps(to_float(p[0]), to_float(p[1]), to_float(p[2]), to_float(p[3])); }
+		// A bfloat16 is the upper half of a float
+		static type load(const bfloat16* p)
+		{
+			return _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+		}
+		static void store(float* p, type v) { _mm_storeu_ps(p, v); }
+		static type add(type a, type b) { return _mm_add_ps(a, b); }
+		static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+		static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+		static type div(type a, type b) { return _mm_div_ps(a, b); }
+		static type fmadd(type a, type b, type c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+		static type min(type a, type b) { return _mm_min_ps(a, b); }
+		static type max(type a, type b) { return _mm_max_ps(a, b); }
+		static type round(type v) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(v)); }
+
+		static type select_less(type a, type b, type x, type y)
+		{
+			const __m128 mask = _mm_cmplt_ps(a, b);
+			return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y));
+		}
+
+		static type pow2n(type n)
+		{
+			return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+		}
+
+		static void transpose_tile(const float* source, size_t source_stride, float* destination, size_t destination_stride)
+		{
+			__m128 row0 = _mm_loadu_ps(source);
+			__m128 row1 = _mm_loadu_ps(source + source_stride);
+			__m128 row2 = _mm_loadu_ps(source + 2 * source_stride);
+			__m128 row3 = _mm_loadu_ps(source + 3 * source_stride);
+			_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+			_mm_storeu_ps(destination, row0);
+			_mm_storeu_ps(destination + destination_stride, row1);
+			_mm_storeu_ps(destination + 2 * destination_stride, row2);
+			_mm_storeu_ps(destination + 3 * destination_stride, row3);
+		}
+	};
+}
+
+#define KERNEL_MR 4
+#define KERNEL_NR 8
+#include "kernels_impl.h"
+
+namespace
+{
+	// Adds the products of 16 pairs of int8 values to the 4 lanes of sum, widening them to 16 bits first
+	inline __m128i dot_s8(__m128i sum, __m128i a, __m128i b)
+	{
+		const __m128i a_low = _mm_srai_epi16(_mm_unpacklo_epi8(a, a), 8);
+		const __m128i a_high = _mm_srai_epi16(_mm_unpackhi_epi8(a, a), 8);
+		const __m128i b_low = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+		const __m128i b_high = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+		return _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(a_low, b_low), _mm_madd_epi16(a_high, b_high)));
+	}
+
+	// R rows of A times C rows of B, every vector of B is loaded once for all rows of A
+	template<int R, int C>
+	void gemm_s8_block(int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc)
+	{
+		__m128i sums[R][C];
+		KERNEL_UNROLL
+		for (int r = 0; r < R; r++)
+		{
+			KERNEL_UNROLL
+			for (int j = 0; j < C; j++)
+				sums[r][j] = _mm_setzero_si128();
+		}
+
+		int p = 0;
+		for (; p + 16 <= k; p += 16)
+		{
+			__m128i b_values[C];
+			KERNEL_UNROLL
+			for (int j = 0; j < C; j++)
+				b_values[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + (size_t)j * ldb + p));
+
+			KERNEL_UNROLL
+			for (int r = 0; r < R; r++)
+			{
+				const __m128i a_values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + (size_t)r * lda + p));
+				KERNEL_UNROLL
+				for (int j = 0; j < C; j++)
+					sums[r][j] = dot_s8(sums[r][j], a_values, b_values[j]);
+			}
+		}
+
+		for (int r = 0; r < R; r++)
+		{
+			for (int j = 0; j < C; j++)
+			{
+				alignas(16) int32_t lanes[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes), sums[r][j]);
+
+				int32_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+				for (int q = p; q < k; q++)
+					sum += (int32_t)a[(size_t)r * lda + q] * b[(size_t)j * ldb + q];
+				c[(size_t)r * ldc + j] = sum;
+			}
+		}
+	}
+
+	template<int R>
+	void gemm_s8_rows(int n, int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc)
+	{
+		int j = 0;
+		for (; j + 4 <= n; j += 4)
+			gemm_s8_block<R, 4>(k, a, lda, b + (size_t)j * ldb, ldb, c + j, ldc);
+		for (; j < n; j++)
+			gemm_s8_block<R, 1>(k, a, lda, b + (size_t)j * ldb, ldb, c + j, ldc);
+	}
+
+	void gemm_s8_kernel(int m, int n, int k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c, size_t ldc)
+	{
+		int i = 0;
+		for (; i + 2 <= m; i += 2)
+			gemm_s8_rows<2>(n, k, a + (size_t)i * lda, lda, b, ldb, c + (size_t)i * ldc, ldc);
+		if (i < m)
+			gemm_s8_rows<1>(n, k, a + (size_t)i * lda, lda, b, ldb, c + (size_t)i * ldc, ldc);
+	}
+
+	void quantize_s8_kernel(size_t count, float inverse_scale, const float* x, int8_t* y)
+	{
+		const __m128 scale = _mm_set1_ps(inverse_scale);
+		const __m128 low = _mm_set1_ps(-127.f);
+		const __m128 high = _mm_set1_ps(127.f);
+
+		size_t i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i q[4];
+			for (int v = 0; v < 4; v++)
+				q[v] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(x + i + 4 * v), scale), low), high));
+
+			const __m128i bytes = _mm_packs_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), bytes);
+		}
+
+		for (; i < count; i++)
+			y[i] = (int8_t)std::lrint(std::min(std::max(x[i] * inverse_scale, -127.f), 127.f));
+	}
+}
+
+const kernel_table sse2_kernels = { instruction_set::sse2, KERNEL_MR, KERNEL_NR, gemm_micro_kernel, gemv_kernel<float>, gemv_kernel<float16>, gemv_kernel<bfloat16>,
+	activate_kernel, transpose_kernel, axpby_kernel, gemm_s8_kernel, quantize_s8_kernel };
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -3,8 +3,10 @@
 
 #include "neural_net.h"
 #include "auxiliary.h"
+#include "mnist.h"
+#include "data_loader.h"
 
-void print(const matrix& values)
+void print(const matrix_view& values)
 {
 	for (int j = 0; j < values.get_height(); j++)
 	{
@@ -65,107 +67,32 @@ float calculate_error(const matrix& output, const matrix& required_output)
 void digits()
 {
 	//Load data
-
-	struct
-	{
-		binary_data data;
-		int32_t magic_number = 0;
-		int32_t items_num = 0;
-	} labels;
-	struct
-	{
-		binary_data data;
-		int32_t magic_number = 0;
-		int32_t items_num = 0;
-		int32_t num_of_rows = 0;
-		int32_t num_of_columns = 0;
-	} images;
-
 	std::cout << "Loading data into memory...\n";
 
-	//Data source is http://yann.lecun.com/exdb/mnist/
-	labels.data = read_file("train-labels.idx1-ubyte");
-	images.data = read_file("train-images.idx3-ubyte");
-
-	if (!labels.data.get_data() || !images.data.get_data())
-	{
-		std::cout << "ERROR: couldn't load data!\n";
+	mnist_data data;
+	if (!load_mnist("train-images.idx3-ubyte", "train-labels.idx1-ubyte", data))
 		return;
-	}
 
 	std::cout << "Processing data...\n";
 
-	labels.magic_number = *(int32_t*)labels.data.get_data();
-	labels.items_num = *(int32_t*)(labels.data.get_data() + 4);
-
-	images.magic_number = *(int32_t*)images.data.get_data();
-	images.items_num = *(int32_t*)(images.data.get_data() + 4);
-	images.num_of_rows = *(int32_t*)(images.data.get_data() + 8);
-	images.num_of_columns = *(int32_t*)(images.data.get_data() + 12);
-
-	if (is_little_endian())
-	{
-		swap_byte_order((char*)&labels.magic_number, sizeof(int32_t));
-		swap_byte_order((char*)&labels.items_num, sizeof(int32_t));
-		swap_byte_order((char*)&images.magic_number, sizeof(int32_t));
-		swap_byte_order((char*)&images.items_num, sizeof(int32_t));
-		swap_byte_order((char*)&images.num_of_rows, sizeof(int32_t));
-		swap_byte_order((char*)&images.num_of_columns, sizeof(int32_t));
-	}
-
-	if (labels.magic_number != 0x00000801 || images.magic_number != 0x00000803)
-	{
-		std::cout << "ERROR: magic numbers don't match!\n";
-		return;
-	}
-
-	if (labels.items_num != images.items_num)
-	{
-		std::cout << "ERROR: data sizes don't match\n";
-		return;
-	}
-
-	const int input_layer_size = images.num_of_rows * images.num_of_columns;
-	const int output_layer_size = 10;
+	const int input_layer_size = data.get_sample_size();
+	const int output_layer_size = mnist_num_classes;
 	const int test_samples_num = 100;
-	const int train_samples_num = images.items_num - test_samples_num;
-	matrix train_input(input_layer_size, train_samples_num);
-	matrix train_required_output(output_layer_size, train_samples_num, 0.f);
-	matrix test_input(input_layer_size, test_samples_num);
-	matrix test_required_output(output_layer_size, test_samples_num, 0.f);
+	const int train_samples_num = data.num_samples - test_samples_num;
+	matrix test_input, test_required_output;
 
-	const float mul = 1.f / 255;
-
-
-	//Init training data
-	for (int j = 0; j < train_samples_num; j++)
-	{
-		for (int k = 0; k < input_layer_size; k++)
-		{
-			const char* pixel_addr = images.data.get_data() + 16 + input_layer_size * j + k;
-			train_input.at(j, k) = *reinterpret_cast<const uint8_t*>(pixel_addr) * mul;
-		}
-		const char* label_addr = labels.data.get_data() + 8 + j;
-		train_required_output.at(j, *reinterpret_cast<const uint8_t*>(label_addr)) = 1.f;
-	}
+	//Training data is converted batch by batch in the background
+	const int batch_size = 100;
+	data_loader loader(data, 0, train_samples_num, batch_size);
 
 	//Init testing data
-	for (int j = 0; j < test_samples_num; j++)
-	{
-		for (int k = 0; k < input_layer_size; k++)
-		{
-			const char* pixel_addr = images.data.get_data() + 16 + input_layer_size * (j + train_samples_num) + k;
-			test_input.at(j, k) = *reinterpret_cast<const uint8_t*>(pixel_addr) * mul;
-		}
-		const char* label_addr = labels.data.get_data() + 8 + j + train_samples_num;
-		test_required_output.at(j, *reinterpret_cast<const uint8_t*>(label_addr)) = 1.f;
-	}
+	mnist_samples(data, train_samples_num, test_samples_num, test_input, test_required_output);
 
 	//Construct neural network
 	const int num_layers = 3;
 	const int layer_sizes[num_layers] = {input_layer_size, 80, output_layer_size };
 	neural_net net(num_layers, layer_sizes);
-
+	neural_net::training_workspace ws(net, 1);
 
 	//Start training
 	std::cout << "Training...\n";
@@ -174,8 +101,16 @@ void digits()
 	const int num_iter = 1000;
 	for (int h = 0; h < 100; h++)
 	{
-		net.train_stochastic(train_input, train_required_output, num_iter, rate);
-		
+		//Every sample of an epoch once, in a shuffled order
+		for (int i = 0; i < num_iter / batch_size; i++)
+		{
+			const data_loader::batch& b = loader.next();
+			for (int j = 0; j < b.input.get_height(); j++)
+			{
+				net.train_stochastic(b.input.rows(j, j + 1), b.required_output.rows(j, j + 1), 1, rate, ws);
+			}
+		}
+
 		net.save_to_file("digits_net.bin");
 
 		//Calculate error
@@ -185,6 +120,10 @@ void digits()
 		std::cout << "Error: " << error << '\n';
 	}
 
+	const data_loader::statistics loader_stats = loader.get_statistics();
+	std::cout << "Batch load time: " << loader_stats.mean_load_time * 1e3 << " ms, stalls: " << loader_stats.stalls
+		<< ", stall time: " << loader_stats.total_stall_time * 1e3 << " ms\n";
+
 	net.load_from_file("digits_net.bin");
 
 	// Print results
@@ -193,8 +132,8 @@ void digits()
 	//For every image print the result
 	for (int j = 0; j < test_samples_num; j++)
 	{
-		print_image(test_input.get_data() + j * input_layer_size, images.num_of_columns, images.num_of_rows);
-		print(test_required_output.submatrix(j, j + 1));
+		print_image(test_input.get_data() + j * input_layer_size, data.num_columns, data.num_rows);
+		print(test_required_output.rows(j, j + 1));
 
 		matrix normalized_output = test_output.submatrix(j, j + 1);
 		normalized_output = normalized_output / (normalized_output * matrix(1, normalized_output.get_width(), 1.f)).at(0);
@@ -247,6 +186,14 @@ void simple_example()
 	net.save_to_file("simple_example.bin");
 	net.load_from_file("simple_example.bin");
 	print(net.run(input));
+
+	//Saving a mapped net over the file it's mapped from, the reloaded net should give the same output
+	std::cout << "Test saving a mapped net to its own file\n";
+	net.map_from_file("simple_example.bin");
+	net.save_to_file("simple_example.bin");
+	neural_net reloaded(num_layers, layer_sizes);
+	reloaded.load_from_file("simple_example.bin");
+	print(matrix(reloaded.run(input) - net.run(input)));
 }
 
 int main()
@@ -0,0 +1,104 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const char* file_name)
+{
+	close();
+
+	file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		file_handle = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (!mapping_handle)
+	{
+		close();
+		return false;
+	}
+
+	data = static_cast<char*>(MapViewOfFile(mapping_handle, FILE_MAP_COPY, 0, 0, 0));
+	if (!data)
+	{
+		close();
+		return false;
+	}
+
+	size = (size_t)file_size.QuadPart;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (data) UnmapViewOfFile(data);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle) CloseHandle(file_handle);
+
+	data = nullptr;
+	size = 0;
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+}
+
+#else
+
+bool mapped_file::open(const char* file_name)
+{
+	close();
+
+	const int fd = ::open(file_name, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	// Writable private mapping of a read-only file: written pages are copied, the file never changes
+	void* address = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (address == MAP_FAILED) return false;
+
+	data = static_cast<char*>(address);
+	size = (size_t)file_stat.st_size;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (data) munmap(data, size);
+
+	data = nullptr;
+	size = 0;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+
+// File mapped into memory with private copy-on-write pages.
+// Pages are shared with the page cache and other processes mapping the same file until they are written to.
+class mapped_file
+{
+	char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+
+public:
+	mapped_file() {}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	~mapped_file();
+
+	bool open(const char* file_name);
+
+	void close();
+
+	char* get_data() const
+	{
+		return data;
+	}
+
+	size_t get_size() const
+	{
+		return size;
+	}
+};
@@ -1,60 +1,105 @@
 #include "matrix.h"
+#include "gemm.h"
+#include "kernels.h"
+#include "profiler.h"
+#include "thread_pool.h"
 #include <cstring>
 #include <cmath>
+#include <atomic>
+#include <utility>
+#include <algorithm>
 
-matrix::matrix(int width, int height) : width(width), height(height)
+static std::atomic<size_t> allocation_count{ 0 };
+
+// New buffers come from the allocator current on this thread, the shared pool by default
+void matrix::allocate(size_t size)
 {
-	assert(width > 0);
-	assert(height > 0);
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
 
-	values = new float[width * height];
+	allocator = &matrix_allocator::get_current();
+	values = allocator->allocate(size);
+	capacity = size;
 }
 
-matrix::matrix(int width, int height, float fill_value) : width(width), height(height)
+void matrix::deallocate()
+{
+	if (values && allocator) allocator->deallocate(values, capacity);
+
+	values = nullptr;
+	capacity = 0;
+	allocator = nullptr;
+}
+
+matrix::matrix(int width, int height) : values(nullptr), width(width), height(height), capacity(0), allocator(nullptr)
 {
 	assert(width > 0);
 	assert(height > 0);
 
-	values = new float[(size_t)width * height];
+	allocate((size_t)width * height);
+}
 
-	for (size_t i = 0; i < (size_t)width * height; i++)
-		values[i] = fill_value;
+matrix::matrix(int width, int height, float fill_value) : matrix(width, height)
+{
+	parallel_elementwise((size_t)width * height, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			values[i] = fill_value;
+	});
 }
 
-matrix::matrix(const matrix& m) : width(m.width), height(m.height)
+// An empty matrix copies and moves as an empty matrix, e.g. the float weights of a net that keeps them in 16 bits
+matrix::matrix(const matrix& m) : matrix()
 {
-	assert(m.is_alive());
-	values = new float[(size_t)width * height];
+	if (!m.is_alive()) return;
 
+	width = m.width;
+	height = m.height;
+	allocate((size_t)width * height);
 	memcpy(values, m.values, (size_t)width * height * sizeof(float));
 }
 
-matrix::matrix(matrix&& m) noexcept : width(m.width), height(m.height)
+matrix::matrix(matrix&& m) noexcept : width(m.width), height(m.height), capacity(m.capacity), allocator(m.allocator)
 {
-	assert(m.is_alive());
 	values = m.values;
 	m.values = nullptr;
+	m.capacity = 0;
+	m.allocator = nullptr;
 }
 
 matrix::~matrix()
 {
-	if (values) delete[] values;
+	deallocate();
 }
 
-matrix& matrix::operator=(const matrix& m)
+matrix matrix::wrap(float* values, int width, int height)
 {
-	assert(m.is_alive());
+	assert(values);
+	assert(width > 0);
+	assert(height > 0);
 
-	if (m.width != width || m.height != height)
-	{
-		if (values) delete[] values;
+	matrix result;
+	result.values = values;
+	result.width = width;
+	result.height = height;
+	result.capacity = (size_t)width * height;
+	result.allocator = nullptr;
+	return result;
+}
 
-		width = m.width;
-		height = m.height;
+matrix& matrix::operator=(const matrix& m)
+{
+	if (this == &m) return *this;
 
-		values = new float[(size_t)width * height];
+	if (!m.is_alive())
+	{
+		deallocate();
+		width = 0;
+		height = 0;
+		return *this;
 	}
 
+	resize(m.width, m.height);
+
 	memcpy(values, m.values, (size_t)width * height * sizeof(float));
 
 	return *this;
@@ -62,19 +107,42 @@ matrix& matrix::operator=(const matrix& m)
 
 matrix& matrix::operator=(matrix&& m) noexcept
 {
-	assert(m.is_alive());
-
-	if (values) delete[] values;
+	deallocate();
 
 	width = m.width;
 	height = m.height;
+	capacity = m.capacity;
+	allocator = m.allocator;
 
 	values = m.values;
 	m.values = nullptr;
+	m.capacity = 0;
+	m.allocator = nullptr;
 
 	return *this;
 }
 
+void matrix::resize(int width, int height)
+{
+	assert(width > 0);
+	assert(height > 0);
+
+	const size_t size = (size_t)width * height;
+	if (!values || size > capacity)
+	{
+		deallocate();
+		allocate(size);
+	}
+
+	this->width = width;
+	this->height = height;
+}
+
+size_t matrix::get_allocation_count()
+{
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
 matrix matrix::submatrix(int row_a, int row_b, int column_a, int column_b) const
 {
 	assert(row_a >= 0 && row_a < row_b);
@@ -102,6 +170,39 @@ matrix matrix::submatrix(int row_a, int row_b) const
 	return result;
 }
 
+matrix::matrix(const matrix_view& v) : matrix(v.get_width(), v.get_height())
+{
+	*this = v;
+}
+
+matrix& matrix::operator=(const matrix_view& v)
+{
+	assert(v.is_alive());
+	assert(v.get_data() != values);
+
+	resize(v.get_width(), v.get_height());
+
+	if (v.is_contiguous())
+	{
+		memcpy(values, v.get_data(), (size_t)width * height * sizeof(float));
+		return *this;
+	}
+
+	for (int i = 0; i < height; i++)
+		memcpy(values + (size_t)i * width, v.row(i), width * sizeof(float));
+
+	return *this;
+}
+
+void matrix::submatrix(int row_a, int row_b, matrix& result) const
+{
+	assert(row_a >= 0 && row_a < row_b && row_b <= height);
+	assert(&result != this);
+
+	result.resize(width, row_b - row_a);
+	memcpy(result.get_data(), values + (size_t)row_a * width, (size_t)(row_b - row_a) * width * sizeof(float));
+}
+
 matrix submatrix(const matrix& m, int row_a, int row_b, int column_a, int column_b)
 {
 	assert(row_a >= 0 && row_a < row_b);
@@ -118,31 +219,41 @@ matrix submatrix(const matrix& m, int row_a, int row_b, int column_a, int column
 	return result;
 }
 
-matrix sqrt(const matrix& m)
+void multiply(const matrix_view& a, bool transpose_a, const matrix_view& b, bool transpose_b, matrix& result)
 {
-	matrix result(m.get_width(), m.get_height());
-	for (size_t i = 0; i < (size_t)result.get_width() * result.get_height(); i++)
-	{
-		result.at(i) = sqrtf(m.at(i));
-	}
+	assert(a.is_alive() && b.is_alive());
+	assert(result.get_data() != a.get_data() && result.get_data() != b.get_data());
 
-	return result;
+	const int m = transpose_a ? a.get_width() : a.get_height();
+	const int k = transpose_a ? a.get_height() : a.get_width();
+	const int n = transpose_b ? b.get_height() : b.get_width();
+	assert(k == (transpose_b ? b.get_width() : b.get_height()));
+	PROFILE_SCOPE("gemm", -1, 2. * m * n * k, sizeof(float) * ((double)m * k + (double)k * n + (double)m * n));
+
+	result.resize(n, m);
+
+	gemm(transpose_a, transpose_b, m, n, k,
+		a.get_data(), a.get_stride(), b.get_data(), b.get_stride(), result.get_data(), result.get_width());
 }
 
-matrix hadamard_product(const matrix& a, const matrix& b)
+void multiply(const matrix_view& a, const matrix_view& b, matrix& result)
 {
-	assert(a.is_alive() && b.is_alive());
-	assert(a.get_width() == b.get_width());
-	assert(a.get_height() == b.get_height());
+	multiply(a, false, b, false, result);
+}
 
-	matrix result(a.get_width(), a.get_height());
+void multiply(const transposed_matrix& a, const matrix_view& b, matrix& result)
+{
+	multiply(a.get_matrix(), true, b, false, result);
+}
 
-	for (size_t i = 0; i < (size_t)result.get_height() * a.get_width(); i++)
-	{
-		result.at(i) = a.at(i) * b.at(i);
-	}
+void multiply(const matrix_view& a, const transposed_matrix& b, matrix& result)
+{
+	multiply(a, false, b.get_matrix(), true, result);
+}
 
-	return result;
+void multiply(const transposed_matrix& a, const transposed_matrix& b, matrix& result)
+{
+	multiply(a.get_matrix(), true, b.get_matrix(), true, result);
 }
 
 matrix operator*(const matrix& a, const matrix& b)
@@ -152,154 +263,115 @@ matrix operator*(const matrix& a, const matrix& b)
 	
 	matrix result(b.get_width(), a.get_height());
 
-	for (int i = 0; i < result.get_height(); i++)
-	{
-		for (int j = 0; j < result.get_width(); j++)
-		{
-			result.at(i, j) = 0;
-
-			for (int k = 0; k < a.get_width(); k++)
-			{
-				result.at(i, j) += a.at(i, k) * b.at(k, j);
-			}
-		}
-	}
+	multiply(a, b, result);
 
 	return result;
 }
 
-matrix operator*(const matrix& m, float v)
+matrix operator*(const transposed_matrix& a, const matrix& b)
 {
-	assert(m.is_alive());
-
-	matrix result(m.get_width(), m.get_height());
-
-	for (size_t i = 0; i < (size_t)result.get_width()*result.get_height(); i++)
-	{
-		result.at(i) = m.at(i) * v;
-	}
-
+	matrix result(b.get_width(), a.get_height());
+	multiply(a, b, result);
 	return result;
 }
 
-matrix operator/(float v, const matrix& m)
+matrix operator*(const matrix& a, const transposed_matrix& b)
 {
-	assert(m.is_alive());
-
-	matrix result(m.get_width(), m.get_height());
-
-	for (size_t i = 0; i < (size_t)result.get_width() * result.get_height(); i++)
-	{
-		result.at(i) = v / m.at(i);
-	}
-
+	matrix result(b.get_width(), a.get_height());
+	multiply(a, b, result);
 	return result;
 }
 
-matrix operator+(const matrix& a, const matrix& b)
+matrix operator*(const transposed_matrix& a, const transposed_matrix& b)
 {
-	assert(a.is_alive() && b.is_alive());
-	assert(a.get_width() == b.get_width());
-	assert(a.get_height() == b.get_height());
-
-	matrix result(a.get_width(), a.get_height());
-
-	for (size_t i = 0; i < (size_t)result.get_height() * result.get_width(); i++)
-	{
-		result.at(i) = a.at(i) + b.at(i);
-	}
-
+	matrix result(b.get_width(), a.get_height());
+	multiply(a, b, result);
 	return result;
 }
 
-matrix operator-(const matrix& a, const matrix& b)
-{
-	assert(a.is_alive() && b.is_alive());
-	assert(a.get_width() == b.get_width());
-	assert(a.get_height() == b.get_height());
-
-	matrix result(a.get_width(), a.get_height());
+static constexpr int TRANSPOSE_BLOCK = 32;
 
-	for (size_t i = 0; i < (size_t)result.get_height() * result.get_width(); i++)
-	{
-		result.at(i) = a.at(i) - b.at(i);
-	}
-
-	return result;
-}
-
-matrix operator-(const matrix& m)
+void transpose(const matrix_view& m, matrix& result)
 {
 	assert(m.is_alive());
+	assert(result.get_data() != m.get_data());
+	PROFILE_SCOPE("transpose", -1, 0., 2. * sizeof(float) * m.get_width() * m.get_height());
 
-	matrix result(m.get_width(), m.get_height());
-
-	for (size_t i = 0; i < (size_t)result.get_height() * result.get_width(); i++)
-	{
-		result.at(i) = -m.at(i);
-	}
+	result.resize(m.get_height(), m.get_width());
 
-	return result;
-}
-
-matrix operator+(const matrix& m, float v)
-{
-	assert(m.is_alive());
+	const int rows = result.get_height();
+	const int columns = result.get_width();
+	const float* source = m.get_data();
+	const size_t source_stride = m.get_stride();
+	float* destination = result.get_data();
+	const kernel_table& kernel = kernels();
 
-	matrix result(m.get_width(), m.get_height());
+	// Square blocks keep both the rows being read and the rows being written in L1
+	const size_t row_blocks = (rows + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+	const size_t size = (size_t)rows * columns;
+	const size_t block_grain = size < parallel_elementwise_threshold ? row_blocks :
+		parallel_elementwise_threshold / 4 / ((size_t)TRANSPOSE_BLOCK * columns) + 1;
 
-	for (size_t i = 0; i < (size_t)result.get_height() * result.get_width(); i++)
+	parallel_for(row_blocks, block_grain, [&](size_t begin, size_t end)
 	{
-		result.at(i) = m.at(i) + v;
-	}
-
-	return result;
+		for (int i0 = (int)begin * TRANSPOSE_BLOCK; i0 < std::min((int)end * TRANSPOSE_BLOCK, rows); i0 += TRANSPOSE_BLOCK)
+		{
+			const int i1 = std::min(i0 + TRANSPOSE_BLOCK, rows);
+			for (int j0 = 0; j0 < columns; j0 += TRANSPOSE_BLOCK)
+			{
+				const int j1 = std::min(j0 + TRANSPOSE_BLOCK, columns);
+				kernel.transpose(source + (size_t)j0 * source_stride + i0, source_stride, destination + (size_t)i0 * columns + j0, columns, j1 - j0, i1 - i0);
+			}
+		}
+	});
 }
 
-matrix operator-(float v, const matrix& m)
+matrix::matrix(const transposed_matrix& t) : matrix(t.get_width(), t.get_height())
 {
-	assert(m.is_alive());
-
-	matrix result(m.get_width(), m.get_height());
+	::transpose(t.get_matrix(), *this);
+}
 
-	for (size_t i = 0; i < (size_t)result.get_height() * result.get_width(); i++)
+matrix& matrix::operator=(const transposed_matrix& t)
+{
+	if (&t.get_matrix() == this)
 	{
-		result.at(i) = v - m.at(i);
+		matrix result(t);
+		return *this = std::move(result);
 	}
 
-	return result;
+	::transpose(t.get_matrix(), *this);
+	return *this;
 }
 
-matrix transpose(const matrix& m)
+void axpby(float alpha, const matrix_view& x, float beta, matrix& y)
 {
-	assert(m.is_alive());
+	assert(x.is_alive() && y.is_alive());
+	assert(x.get_width() == y.get_width() && x.get_height() == y.get_height());
+	PROFILE_SCOPE("axpby", -1, 3. * x.get_width() * x.get_height(), 3. * sizeof(float) * x.get_width() * x.get_height());
 
-	matrix result(m.get_height(), m.get_width());
+	const kernel_table& kernel = kernels();
+	const float* x_values = x.get_data();
+	float* y_values = y.get_data();
 
-	for (int i = 0; i < result.get_height(); i++)
+	if (x.is_contiguous())
 	{
-		for (int j = 0; j < result.get_width(); j++)
+		parallel_elementwise((size_t)x.get_width() * x.get_height(), [&](size_t begin, size_t end)
 		{
-			result.at(i, j) = m.at(j, i);
-		}
+			kernel.axpby(end - begin, alpha, x_values + begin, beta, y_values + begin);
+		});
+		return;
 	}
 
-	return result;
+	const int width = x.get_width();
+	const size_t row_grain = parallel_elementwise_threshold / 4 / width + 1;
+	parallel_for((size_t)x.get_height(), row_grain, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			kernel.axpby(width, alpha, x.row((int)i), beta, y_values + i * width);
+	});
 }
 
-matrix matrix::transpose() const
+transposed_matrix matrix::transpose() const
 {
-	assert(is_alive());
-
-	matrix result(get_height(), get_width());
-
-	for (int i = 0; i < result.get_height(); i++)
-	{
-		for (int j = 0; j < result.get_width(); j++)
-		{
-			result.at(i, j) = at(j, i);
-		}
-	}
-
-	return result;
+	return ::transpose(*this);
 }
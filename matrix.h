@@ -1,17 +1,37 @@
 #pragma once
 #include <cassert>
+#include <cstddef>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include "thread_pool.h"
+#include "matrix_allocator.h"
 
 class matrix;
 
+class matrix_view;
+
+class transposed_matrix;
+
+template<typename E>
+struct matrix_expression;
+
 class matrix
 {
 private:
 	float* values;
 	int width;
 	int height;
+	size_t capacity;
+	matrix_allocator* allocator; // Gets the values back, null if they belong to someone else, see wrap()
+
+	void allocate(size_t size);
+
+	void deallocate();
 
 public:
-	matrix() : values(nullptr), width(0), height(0) {}
+	matrix() : values(nullptr), width(0), height(0), capacity(0), allocator(nullptr) {}
 
 	matrix(int width, int height);
 
@@ -27,6 +47,31 @@ public:
 
 	matrix& operator=(matrix&& m) noexcept;
 
+	template<typename E>
+	matrix(const matrix_expression<E>& e);
+
+	matrix(const transposed_matrix& t);
+
+	// Evaluates the expression in a single pass, reusing the buffer if the shape matches
+	template<typename E>
+	matrix& operator=(const matrix_expression<E>& e);
+
+	matrix& operator=(const transposed_matrix& t);
+
+	// Copies the viewed values
+	explicit matrix(const matrix_view& v);
+
+	matrix& operator=(const matrix_view& v);
+
+	// Matrix over an external buffer of width * height values, which must outlive it.
+	// The buffer is never freed by the matrix, and is only replaced if a resize needs more room.
+	static matrix wrap(float* values, int width, int height);
+
+	bool owns_values() const
+	{
+		return !values || allocator;
+	}
+
 	int get_width() const
 	{
 		return width;
@@ -42,6 +87,17 @@ public:
 		return values;
 	}
 
+	// Changes the shape, reusing the buffer if it is large enough. Values are left unspecified.
+	void resize(int width, int height);
+
+	size_t get_capacity() const
+	{
+		return capacity;
+	}
+
+	// Number of buffers allocated by all matrices so far
+	static size_t get_allocation_count();
+
 	float& at(int row, int column)
 	{
 		assert(row >= 0 && row < height);
@@ -82,51 +138,491 @@ public:
 
 	matrix submatrix(int row_a, int row_b) const;
 
-	matrix transpose() const;
+	// Copies rows [row_a, row_b) into result
+	void submatrix(int row_a, int row_b, matrix& result) const;
+
+	// Rows [row_a, row_b) without copying them
+	matrix_view rows(int row_a, int row_b) const;
+
+	transposed_matrix transpose() const;
+};
+
+// Read-only window into row-major data with a row stride: a whole matrix, a range of its rows or a block of columns.
+// It doesn't own the data, so views are free to create, but the data must outlive them.
+// Matrices convert to views implicitly, so functions that only read their arguments take views.
+class matrix_view
+{
+	const float* values = nullptr;
+	int width = 0;
+	int height = 0;
+	size_t stride = 0;
+
+public:
+	matrix_view() {}
+
+	matrix_view(const float* values, int width, int height, size_t stride) : values(values), width(width), height(height), stride(stride)
+	{
+		assert(values);
+		assert(width > 0 && height > 0);
+		assert(stride >= (size_t)width);
+	}
+
+	matrix_view(const float* values, int width, int height) : matrix_view(values, width, height, (size_t)width) {}
+
+	// An empty matrix gives an empty view
+	matrix_view(const matrix& m) : values(m.get_data()), width(m.get_width()), height(m.get_height()), stride((size_t)m.get_width()) {}
+
+	int get_width() const
+	{
+		return width;
+	}
+
+	int get_height() const
+	{
+		return height;
+	}
+
+	// Distance between the starts of two rows in elements
+	size_t get_stride() const
+	{
+		return stride;
+	}
+
+	bool is_alive() const
+	{
+		return values;
+	}
+
+	bool is_contiguous() const
+	{
+		return stride == (size_t)width;
+	}
+
+	const float* get_data() const
+	{
+		return values;
+	}
+
+	const float* row(int index) const
+	{
+		assert(index >= 0 && index < height);
+		return values + (size_t)index * stride;
+	}
+
+	const float& at(int row, int column) const
+	{
+		assert(row >= 0 && row < height);
+		assert(column >= 0 && column < width);
+		return values[(size_t)row * stride + column];
+	}
+
+	matrix_view rows(int row_a, int row_b) const
+	{
+		assert(row_a >= 0 && row_a < row_b && row_b <= height);
+		return matrix_view(values + (size_t)row_a * stride, width, row_b - row_a, stride);
+	}
+
+	matrix_view block(int row_a, int row_b, int column_a, int column_b) const
+	{
+		assert(row_a >= 0 && row_a < row_b && row_b <= height);
+		assert(column_a >= 0 && column_a < column_b && column_b <= width);
+		return matrix_view(values + (size_t)row_a * stride + column_a, column_b - column_a, row_b - row_a, stride);
+	}
+};
+
+inline matrix_view matrix::rows(int row_a, int row_b) const
+{
+	return matrix_view(*this).rows(row_a, row_b);
+}
+
+// Element-wise operators don't compute anything by themselves, they build expressions
+// that are evaluated in one loop when assigned to a matrix.
+// Expressions hold references to the matrices they are made of, so don't keep them in auto variables.
+
+template<typename E>
+struct matrix_expression
+{
+	const E& self() const
+	{
+		return static_cast<const E&>(*this);
+	}
+};
+
+template<typename T>
+struct is_matrix_operand : std::integral_constant<bool,
+	std::is_same<T, matrix>::value || std::is_base_of<matrix_expression<T>, T>::value> {};
+
+template<typename A, typename B = A>
+using enable_if_operands = std::enable_if_t<is_matrix_operand<A>::value && is_matrix_operand<B>::value, int>;
+
+class matrix_reference : public matrix_expression<matrix_reference>
+{
+	const matrix& m;
+
+public:
+	matrix_reference(const matrix& m) : m(m)
+	{
+		assert(m.is_alive());
+	}
+
+	int get_width() const
+	{
+		return m.get_width();
+	}
+
+	int get_height() const
+	{
+		return m.get_height();
+	}
+
+	float operator[](size_t index) const
+	{
+		return m.get_data()[index];
+	}
+
+	bool reads_transposed(const matrix*) const
+	{
+		return false;
+	}
+};
+
+// View of a transposed matrix, returned by transpose() instead of a copy.
+// Matrix products read the original data in place, and it is only materialized when assigned to a matrix.
+// Like expressions it references the matrix, so it shouldn't outlive it.
+class transposed_matrix : public matrix_expression<transposed_matrix>
+{
+	const matrix& m;
+
+public:
+	explicit transposed_matrix(const matrix& m) : m(m)
+	{
+		assert(m.is_alive());
+	}
+
+	const matrix& get_matrix() const
+	{
+		return m;
+	}
+
+	int get_width() const
+	{
+		return m.get_height();
+	}
+
+	int get_height() const
+	{
+		return m.get_width();
+	}
+
+	float operator[](size_t index) const
+	{
+		const size_t row = index / m.get_height();
+		const size_t column = index % m.get_height();
+		return m.get_data()[column * m.get_width() + row];
+	}
+
+	// Whether an element of t reads another index of t, which can't be evaluated into t in place
+	bool reads_transposed(const matrix* t) const
+	{
+		return &m == t;
+	}
+};
+
+// Matrices are referenced, nested expressions are stored by value
+template<typename T>
+struct expression_operand
+{
+	typedef T type;
+};
+
+template<>
+struct expression_operand<matrix>
+{
+	typedef matrix_reference type;
+};
+
+template<typename Op, typename E>
+class unary_expression : public matrix_expression<unary_expression<Op, E>>
+{
+	typename expression_operand<E>::type e;
+	Op op;
+
+public:
+	unary_expression(const E& e, Op op) : e(e), op(op) {}
+
+	int get_width() const
+	{
+		return e.get_width();
+	}
+
+	int get_height() const
+	{
+		return e.get_height();
+	}
+
+	float operator[](size_t index) const
+	{
+		return op(e[index]);
+	}
+
+	bool reads_transposed(const matrix* m) const
+	{
+		return e.reads_transposed(m);
+	}
+};
+
+template<typename Op, typename A, typename B>
+class binary_expression : public matrix_expression<binary_expression<Op, A, B>>
+{
+	typename expression_operand<A>::type a;
+	typename expression_operand<B>::type b;
+
+public:
+	binary_expression(const A& a, const B& b) : a(a), b(b)
+	{
+		assert(this->a.get_width() == this->b.get_width());
+		assert(this->a.get_height() == this->b.get_height());
+	}
+
+	int get_width() const
+	{
+		return a.get_width();
+	}
+
+	int get_height() const
+	{
+		return a.get_height();
+	}
+
+	float operator[](size_t index) const
+	{
+		return Op()(a[index], b[index]);
+	}
+
+	bool reads_transposed(const matrix* m) const
+	{
+		return a.reads_transposed(m) || b.reads_transposed(m);
+	}
+};
+
+struct add_op
+{
+	float operator()(float a, float b) const { return a + b; }
+};
+
+struct subtract_op
+{
+	float operator()(float a, float b) const { return a - b; }
+};
+
+struct multiply_op
+{
+	float operator()(float a, float b) const { return a * b; }
+};
+
+struct negate_op
+{
+	float operator()(float x) const { return -x; }
+};
+
+struct sqrt_op
+{
+	float operator()(float x) const { return sqrtf(x); }
+};
+
+struct add_scalar_op
+{
+	float v;
+	float operator()(float x) const { return x + v; }
 };
 
+struct multiply_scalar_op
+{
+	float v;
+	float operator()(float x) const { return x * v; }
+};
+
+struct scalar_subtract_op
+{
+	float v;
+	float operator()(float x) const { return v - x; }
+};
+
+struct scalar_divide_op
+{
+	float v;
+	float operator()(float x) const { return v / x; }
+};
+
+template<typename E>
+matrix::matrix(const matrix_expression<E>& e) : matrix(e.self().get_width(), e.self().get_height())
+{
+	const E& expression = e.self();
+	parallel_elementwise((size_t)width * height, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			values[i] = expression[i];
+	});
+}
+
+template<typename E>
+matrix& matrix::operator=(const matrix_expression<E>& e)
+{
+	const E& expression = e.self();
+
+	// A transpose of this matrix reads elements at other indices, which may already be overwritten
+	if (expression.reads_transposed(this))
+	{
+		matrix result(e);
+		return *this = std::move(result);
+	}
+
+	// An expression that references this matrix has its shape, so resize never frees its operands
+	resize(expression.get_width(), expression.get_height());
+
+	// Without transposes of this matrix, every element only depends on the elements of this matrix at the same index,
+	// so evaluating in place is safe
+	parallel_elementwise((size_t)width * height, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			values[i] = expression[i];
+	});
+
+	return *this;
+}
+
 // Functions that generate another matrix and do not modify the original matrix should be outside of the class
 
-matrix hadamard_product(const matrix& a, const matrix& b);
+template<typename A, typename B, enable_if_operands<A, B> = 0>
+binary_expression<multiply_op, A, B> hadamard_product(const A& a, const B& b)
+{
+	return binary_expression<multiply_op, A, B>(a, b);
+}
 
 matrix operator*(const matrix& a, const matrix& b);
 
-matrix operator*(const matrix& m, float v);
+matrix operator*(const transposed_matrix& a, const matrix& b);
+
+matrix operator*(const matrix& a, const transposed_matrix& b);
+
+matrix operator*(const transposed_matrix& a, const transposed_matrix& b);
+
+// Same as result = a * b, but reuses the result's buffer
+void multiply(const matrix_view& a, const matrix_view& b, matrix& result);
+
+void multiply(const transposed_matrix& a, const matrix_view& b, matrix& result);
+
+void multiply(const matrix_view& a, const transposed_matrix& b, matrix& result);
+
+void multiply(const transposed_matrix& a, const transposed_matrix& b, matrix& result);
+
+// result = op(a) * op(b), where op transposes the operands whose flag is set, reading them in place
+void multiply(const matrix_view& a, bool transpose_a, const matrix_view& b, bool transpose_b, matrix& result);
 
-inline matrix operator*(float v, const matrix& m)
+inline const matrix& evaluate(const matrix& m)
+{
+	return m;
+}
+
+inline matrix evaluate(const transposed_matrix& t)
+{
+	return matrix(t);
+}
+
+template<typename E>
+matrix evaluate(const matrix_expression<E>& e)
+{
+	return matrix(e);
+}
+
+// Matrix product of expressions evaluates them first
+template<typename A, typename B, enable_if_operands<A, B> = 0>
+matrix operator*(const A& a, const B& b)
+{
+	return evaluate(a) * evaluate(b);
+}
+
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<multiply_scalar_op, A> operator*(const A& m, float v)
+{
+	return unary_expression<multiply_scalar_op, A>(m, { v });
+}
+
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<multiply_scalar_op, A> operator*(float v, const A& m)
 {
 	return m * v;
 }
 
-inline matrix operator/(const matrix& m, float v)
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<multiply_scalar_op, A> operator/(const A& m, float v)
 {
 	return m * (1.f / v);
 }
 
-matrix operator/(float v, const matrix& m);
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<scalar_divide_op, A> operator/(float v, const A& m)
+{
+	return unary_expression<scalar_divide_op, A>(m, { v });
+}
 
-matrix operator+(const matrix& a, const matrix& b);
+template<typename A, typename B, enable_if_operands<A, B> = 0>
+binary_expression<add_op, A, B> operator+(const A& a, const B& b)
+{
+	return binary_expression<add_op, A, B>(a, b);
+}
 
-matrix operator-(const matrix& a, const matrix& b);
+template<typename A, typename B, enable_if_operands<A, B> = 0>
+binary_expression<subtract_op, A, B> operator-(const A& a, const B& b)
+{
+	return binary_expression<subtract_op, A, B>(a, b);
+}
 
-matrix operator-(const matrix& m);
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<negate_op, A> operator-(const A& m)
+{
+	return unary_expression<negate_op, A>(m, {});
+}
 
-matrix operator+(const matrix& m, float v);
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<add_scalar_op, A> operator+(const A& m, float v)
+{
+	return unary_expression<add_scalar_op, A>(m, { v });
+}
 
-inline matrix operator+(float v, const matrix& m)
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<add_scalar_op, A> operator+(float v, const A& m)
 {
 	return m + v;
 }
 
-matrix operator-(float v, const matrix& m);
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<scalar_subtract_op, A> operator-(float v, const A& m)
+{
+	return unary_expression<scalar_subtract_op, A>(m, { v });
+}
 
-inline matrix operator-(const matrix& m, float v)
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<add_scalar_op, A> operator-(const A& m, float v)
 {
 	return m + -v;
 }
 
-matrix transpose(const matrix& m);
+inline transposed_matrix transpose(const matrix& m)
+{
+	return transposed_matrix(m);
+}
+
+// Copies the transposed matrix into result with a cache-blocked kernel
+void transpose(const matrix_view& m, matrix& result);
+
+// y = alpha * x + beta * y, the update step of the optimizers
+void axpby(float alpha, const matrix_view& x, float beta, matrix& y);
 
 matrix submatrix(const matrix& m, int row_a, int row_b, int column_a, int column_b);
 
-matrix sqrt(const matrix& m);
\ No newline at end of file
+template<typename A, enable_if_operands<A> = 0>
+unary_expression<sqrt_op, A> sqrt(const A& m)
+{
+	return unary_expression<sqrt_op, A>(m, {});
+}
\ No newline at end of file
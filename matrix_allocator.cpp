@@ -0,0 +1,263 @@
+#include "matrix_allocator.h"
+
+#include <new>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+static std::atomic<size_t> heap_allocations{ 0 };
+static std::atomic<size_t> pool_hits{ 0 };
+static std::atomic<size_t> pool_misses{ 0 };
+static std::atomic<size_t> arena_allocations{ 0 };
+static std::atomic<size_t> huge_page_buffers{ 0 };
+
+static bool huge_pages_from_environment()
+{
+	const char* env = std::getenv("SNN_HUGE_PAGES");
+	return env && strcmp(env, "1") == 0;
+}
+
+static std::atomic<bool> huge_pages{ huge_pages_from_environment() };
+
+void set_huge_pages(bool enable)
+{
+	huge_pages.store(enable);
+}
+
+bool get_huge_pages()
+{
+	return huge_pages.load();
+}
+
+matrix_allocator*& matrix_allocator::current()
+{
+	thread_local matrix_allocator* allocator = nullptr;
+	return allocator;
+}
+
+matrix_allocator& matrix_allocator::get_current()
+{
+	matrix_allocator* allocator = current();
+	return allocator ? *allocator : get_pool();
+}
+
+// Never destroyed, matrices with static storage may give their buffers back after the end of main
+matrix_allocator& matrix_allocator::get_heap()
+{
+	static heap_allocator* heap = new heap_allocator();
+	return *heap;
+}
+
+pool_allocator& matrix_allocator::get_pool()
+{
+	static pool_allocator* pool = new pool_allocator();
+	return *pool;
+}
+
+// Huge page sized buffers are aligned to huge pages whether they are enabled or not, so deallocate knows the alignment from the size
+static size_t heap_alignment(size_t bytes)
+{
+	return bytes >= huge_page_size ? huge_page_size : matrix_allocator::alignment;
+}
+
+float* heap_allocator::allocate(size_t& size)
+{
+	assert(size > 0);
+
+	size_t bytes = size * sizeof(float);
+	if (bytes >= huge_page_size)
+	{
+		bytes = (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+		size = bytes / sizeof(float);
+	}
+
+	void* values = ::operator new(bytes, std::align_val_t(heap_alignment(bytes)));
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+
+#if !defined(_WIN32) && defined(MADV_HUGEPAGE)
+	if (bytes >= huge_page_size && huge_pages.load(std::memory_order_relaxed))
+	{
+		if (madvise(values, bytes, MADV_HUGEPAGE) == 0)
+			huge_page_buffers.fetch_add(1, std::memory_order_relaxed);
+	}
+#endif
+
+	return static_cast<float*>(values);
+}
+
+void heap_allocator::deallocate(float* values, size_t size)
+{
+	::operator delete(values, std::align_val_t(heap_alignment(size * sizeof(float))));
+}
+
+// Size classes: 16 floats, then four classes between consecutive powers of two
+static size_t get_class_size(size_t index)
+{
+	if (index == 0) return 16;
+
+	const int k = 4 + (int)((index - 1) / 4);
+	const size_t j = (index - 1) % 4 + 1;
+	return ((size_t)1 << k) + j * (((size_t)1 << k) / 4);
+}
+
+static size_t size_class(size_t size, size_t& class_size)
+{
+	if (size <= 16)
+	{
+		class_size = 16;
+		return 0;
+	}
+
+	int k = 0;
+	while (((size_t)2 << k) < size) k++; // 2^k < size <= 2^(k + 1)
+	const size_t base = (size_t)1 << k;
+	const size_t step = base / 4;
+	const size_t j = (size - base + step - 1) / step;
+
+	class_size = base + j * step;
+	return 1 + (size_t)(k - 4) * 4 + (j - 1);
+}
+
+pool_allocator::~pool_allocator()
+{
+	trim();
+}
+
+float* pool_allocator::allocate(size_t& size)
+{
+	assert(size > 0);
+
+	size_t class_size;
+	const size_t index = size_class(size, class_size);
+	size = class_size;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (index < free_lists.size() && !free_lists[index].empty())
+		{
+			float* values = free_lists[index].back();
+			free_lists[index].pop_back();
+			cached_bytes -= class_size * sizeof(float);
+			pool_hits.fetch_add(1, std::memory_order_relaxed);
+			return values;
+		}
+	}
+
+	pool_misses.fetch_add(1, std::memory_order_relaxed);
+
+	size_t heap_size = class_size;
+	return get_heap().allocate(heap_size);
+}
+
+void pool_allocator::deallocate(float* values, size_t size)
+{
+	size_t class_size;
+	const size_t index = size_class(size, class_size);
+	assert(class_size == size);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (cached_bytes + size * sizeof(float) <= max_cached_bytes)
+		{
+			if (index >= free_lists.size())
+				free_lists.resize(index + 1);
+			free_lists[index].push_back(values);
+			cached_bytes += size * sizeof(float);
+			return;
+		}
+	}
+
+	get_heap().deallocate(values, size);
+}
+
+void pool_allocator::trim()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (size_t i = 0; i < free_lists.size(); i++)
+	{
+		for (float* values : free_lists[i])
+			get_heap().deallocate(values, get_class_size(i));
+		free_lists[i].clear();
+	}
+
+	cached_bytes = 0;
+}
+
+matrix_arena::~matrix_arena()
+{
+	assert(live_buffers == 0);
+
+	for (const block& b : blocks)
+		get_heap().deallocate(b.values, b.size);
+}
+
+float* matrix_arena::allocate(size_t& size)
+{
+	assert(size > 0);
+
+	// Every buffer starts at an alignment boundary
+	const size_t step = matrix_allocator::alignment / sizeof(float);
+	size = (size + step - 1) / step * step;
+
+	// Moves on to the first block with enough room, adding one if there is none
+	while (current_block < blocks.size() && used + size > blocks[current_block].size)
+	{
+		current_block++;
+		used = 0;
+	}
+
+	if (current_block == blocks.size())
+	{
+		size_t new_block_size = size > block_size ? size : block_size;
+		float* values = get_heap().allocate(new_block_size);
+		blocks.push_back({ values, new_block_size });
+		used = 0;
+	}
+
+	float* values = blocks[current_block].values + used;
+	used += size;
+	live_buffers++;
+	arena_allocations.fetch_add(1, std::memory_order_relaxed);
+
+	return values;
+}
+
+void matrix_arena::deallocate(float*, size_t)
+{
+	assert(live_buffers > 0);
+	live_buffers--;
+}
+
+void matrix_arena::reset()
+{
+	assert(live_buffers == 0);
+
+	current_block = 0;
+	used = 0;
+}
+
+allocation_statistics get_allocation_statistics()
+{
+	allocation_statistics result;
+	result.heap_allocations = heap_allocations.load();
+	result.pool_hits = pool_hits.load();
+	result.pool_misses = pool_misses.load();
+	result.arena_allocations = arena_allocations.load();
+	result.huge_page_buffers = huge_page_buffers.load();
+	return result;
+}
+
+void reset_allocation_statistics()
+{
+	heap_allocations.store(0);
+	pool_hits.store(0);
+	pool_misses.store(0);
+	arena_allocations.store(0);
+	huge_page_buffers.store(0);
+}
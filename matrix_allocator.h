@@ -0,0 +1,146 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <mutex>
+
+class pool_allocator;
+
+// Source of matrix buffers. A matrix remembers the allocator of its buffer and gives the buffer back to it.
+// Every buffer is aligned to matrix_allocator::alignment bytes, so SIMD loads of a row start never split a cache line.
+class matrix_allocator
+{
+public:
+	static constexpr size_t alignment = 64;
+
+	virtual ~matrix_allocator() {}
+
+	// Returns room for at least size floats and sets size to the room actually given
+	virtual float* allocate(size_t& size) = 0;
+
+	virtual void deallocate(float* values, size_t size) = 0;
+
+	// Allocator of the matrices created by this thread, the shared pool unless an allocator_scope is active
+	static matrix_allocator& get_current();
+
+	// Plain aligned buffers from the heap
+	static matrix_allocator& get_heap();
+
+	// The pool shared by all threads
+	static pool_allocator& get_pool();
+
+private:
+	friend class allocator_scope;
+	static matrix_allocator*& current();
+};
+
+// Buffers of at least this many bytes are aligned to huge pages and advised to use them (MADV_HUGEPAGE)
+// when huge pages are enabled, by set_huge_pages or by the SNN_HUGE_PAGES=1 environment variable.
+// Large weight and dataset matrices then take fewer TLB entries.
+constexpr size_t huge_page_size = 2 << 20;
+
+void set_huge_pages(bool enable);
+
+bool get_huge_pages();
+
+// Heap allocator, used by the pool and the arena for their own memory
+class heap_allocator : public matrix_allocator
+{
+public:
+	float* allocate(size_t& size) override;
+
+	void deallocate(float* values, size_t size) override;
+};
+
+// Keeps freed buffers in lists by size class and hands them out again, so matrices of a shape that comes and goes,
+// like the temporaries of a training step, stop reaching malloc. Sizes are rounded up to classes at most 25% apart.
+// At most max_cached_bytes are kept, a buffer freed beyond that goes back to the heap.
+class pool_allocator : public matrix_allocator
+{
+	std::mutex mutex;
+	std::vector<std::vector<float*>> free_lists;
+	size_t cached_bytes = 0;
+	size_t max_cached_bytes;
+
+public:
+	explicit pool_allocator(size_t max_cached_bytes = (size_t)256 << 20) : max_cached_bytes(max_cached_bytes) {}
+
+	~pool_allocator();
+
+	float* allocate(size_t& size) override;
+
+	void deallocate(float* values, size_t size) override;
+
+	// Returns the cached buffers to the heap
+	void trim();
+};
+
+// Bump allocator for the temporaries of one step: allocation is a pointer increment and nothing is freed
+// until reset() or the destructor, which is when all matrices allocated from it must be gone.
+class matrix_arena : public matrix_allocator
+{
+	struct block
+	{
+		float* values;
+		size_t size;
+	};
+
+	std::vector<block> blocks;
+	size_t current_block = 0;
+	size_t used = 0; // Floats used in the current block
+	size_t block_size;
+	size_t live_buffers = 0;
+
+public:
+	// block_size in floats, larger requests get a block of their own
+	explicit matrix_arena(size_t block_size = (size_t)1 << 20) : block_size(block_size) {}
+
+	matrix_arena(const matrix_arena&) = delete;
+	matrix_arena& operator=(const matrix_arena&) = delete;
+
+	~matrix_arena();
+
+	float* allocate(size_t& size) override;
+
+	void deallocate(float* values, size_t size) override;
+
+	// Makes the whole arena available again, keeping its blocks
+	void reset();
+};
+
+// Sets the allocator of the matrices created by this thread until the end of the scope
+class allocator_scope
+{
+	matrix_allocator* previous;
+
+public:
+	explicit allocator_scope(matrix_allocator& a) : previous(matrix_allocator::current())
+	{
+		matrix_allocator::current() = &a;
+	}
+
+	allocator_scope(const allocator_scope&) = delete;
+	allocator_scope& operator=(const allocator_scope&) = delete;
+
+	~allocator_scope()
+	{
+		matrix_allocator::current() = previous;
+	}
+};
+
+struct allocation_statistics
+{
+	size_t heap_allocations = 0; // Buffers that came from the heap, including the pool's misses and the arena's blocks
+	size_t pool_hits = 0;
+	size_t pool_misses = 0;
+	size_t arena_allocations = 0;
+	size_t huge_page_buffers = 0;
+
+	double get_pool_hit_rate() const
+	{
+		return pool_hits + pool_misses ? (double)pool_hits / (pool_hits + pool_misses) : 0.;
+	}
+};
+
+allocation_statistics get_allocation_statistics();
+
+void reset_allocation_statistics();
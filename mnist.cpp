@@ -0,0 +1,88 @@
+#include "mnist.h"
+#include "auxiliary.h"
+
+#include <iostream>
+#include <cstdint>
+
+static int32_t read_big_endian(const char* p)
+{
+	int32_t value = *reinterpret_cast<const int32_t*>(p);
+	if (is_little_endian())
+		swap_byte_order(reinterpret_cast<char*>(&value), sizeof(value));
+	return value;
+}
+
+bool load_mnist(const char* images_file_name, const char* labels_file_name, mnist_data& data)
+{
+	data.labels = read_file(labels_file_name);
+	data.images = read_file(images_file_name);
+
+	if (!data.labels.get_data() || !data.images.get_data())
+	{
+		std::cout << "ERROR: couldn't load data!\n";
+		return false;
+	}
+
+	if (data.labels.get_size() < 8 || data.images.get_size() < 16 ||
+		read_big_endian(data.labels.get_data()) != 0x00000801 || read_big_endian(data.images.get_data()) != 0x00000803)
+	{
+		std::cout << "ERROR: magic numbers don't match!\n";
+		return false;
+	}
+
+	const int32_t labels_num = read_big_endian(data.labels.get_data() + 4);
+	data.num_samples = read_big_endian(data.images.get_data() + 4);
+	data.num_rows = read_big_endian(data.images.get_data() + 8);
+	data.num_columns = read_big_endian(data.images.get_data() + 12);
+
+	if (labels_num != data.num_samples ||
+		data.labels.get_size() < 8 + (unsigned long long)labels_num ||
+		data.images.get_size() < 16 + (unsigned long long)data.num_samples * data.get_sample_size())
+	{
+		std::cout << "ERROR: data sizes don't match\n";
+		return false;
+	}
+
+	return true;
+}
+
+byte_matrix_view mnist_images(const mnist_data& data, int first, int num_samples)
+{
+	assert(first >= 0 && num_samples > 0 && first + num_samples <= data.num_samples);
+
+	return byte_matrix_view(data.get_image(first), data.get_sample_size(), num_samples, mnist_pixel_scale);
+}
+
+void mnist_sample(const mnist_data& data, int index, float* input, float* required_output)
+{
+	assert(index >= 0 && index < data.num_samples);
+
+	const int sample_size = data.get_sample_size();
+	const float mul = mnist_pixel_scale;
+
+	const uint8_t* image = data.get_image(index);
+	for (int k = 0; k < sample_size; k++)
+	{
+		input[k] = image[k] * mul;
+	}
+
+	for (int k = 0; k < mnist_num_classes; k++)
+	{
+		required_output[k] = 0.f;
+	}
+	required_output[data.get_label(index)] = 1.f;
+}
+
+void mnist_samples(const mnist_data& data, int first, int num_samples, matrix& input, matrix& required_output)
+{
+	assert(first >= 0 && num_samples > 0 && first + num_samples <= data.num_samples);
+
+	input.resize(data.get_sample_size(), num_samples);
+	required_output.resize(mnist_num_classes, num_samples);
+
+	for (int j = 0; j < num_samples; j++)
+	{
+		mnist_sample(data, first + j, input.get_data() + (size_t)j * input.get_width(),
+			required_output.get_data() + (size_t)j * mnist_num_classes);
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+#include "binary_data.h"
+#include "matrix.h"
+#include "byte_matrix.h"
+
+// MNIST data set in the IDX format, kept as loaded from the files.
+// Data source is http://yann.lecun.com/exdb/mnist/
+struct mnist_data
+{
+	binary_data labels;
+	binary_data images;
+	int num_samples = 0;
+	int num_rows = 0;
+	int num_columns = 0;
+
+	int get_sample_size() const
+	{
+		return num_rows * num_columns;
+	}
+
+	const uint8_t* get_image(int index) const
+	{
+		return reinterpret_cast<const uint8_t*>(images.get_data()) + 16 + (size_t)get_sample_size() * index;
+	}
+
+	int get_label(int index) const
+	{
+		return *reinterpret_cast<const uint8_t*>(labels.get_data() + 8 + index);
+	}
+};
+
+constexpr int mnist_num_classes = 10;
+
+// Reads the image and label files and checks their headers, prints the reason on failure
+bool load_mnist(const char* images_file_name, const char* labels_file_name, mnist_data& data);
+
+// Pixels scale of the images kept as bytes
+constexpr float mnist_pixel_scale = 1.f / 255;
+
+// Images of num_samples samples starting at first, read in place from the file data, one per row
+byte_matrix_view mnist_images(const mnist_data& data, int first, int num_samples);
+
+// Converts one sample into get_sample_size() pixels scaled to [0, 1] and mnist_num_classes one-hot values
+void mnist_sample(const mnist_data& data, int index, float* input, float* required_output);
+
+// Converts num_samples samples starting at first into rows of pixels scaled to [0, 1]
+// and one-hot rows of required output
+void mnist_samples(const mnist_data& data, int first, int num_samples, matrix& input, matrix& required_output);
@@ -1,5 +1,17 @@
 #include "neural_net.h"
 #include "auxiliary.h"
+#include "dense_layer.h"
+#include "kernels.h"
+#include "mapped_file.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <utility>
+#include <random>
+#include <thread>
+#include <cstddef>
+#include <cstdio>
+#include <string>
 
 void neural_net::layer::init()
 {
@@ -14,7 +26,11 @@ void neural_net::layer::init()
 	}
 }
 
-neural_net::neural_net(const int num_layers, const int* const layer_sizes)
+neural_net::neural_net(const int num_layers, const int* const layer_sizes) : neural_net(num_layers, layer_sizes, nullptr)
+{
+}
+
+neural_net::neural_net(const int num_layers, const int* const layer_sizes, const activation* const layer_activations)
 {
 	assert(num_layers > 1);
 	assert(layer_sizes != nullptr);
@@ -29,91 +45,389 @@ neural_net::neural_net(const int num_layers, const int* const layer_sizes)
 	{
 		assert(layer_sizes[i] > 0);
 
-		layers.emplace_back(layer_sizes[i], layer_sizes[i - 1]);
+		const activation f = layer_activations ? layer_activations[i - 1] : activation::sigmoid;
+		assert(f != activation::softmax || i == num_layers - 1);
+
+		layers.emplace_back(layer_sizes[i], layer_sizes[i - 1], f);
 		layers.back().init();
 	}
 }
 
+neural_net::training_workspace::training_workspace(const neural_net& net, int max_batch_size) : max_batch_size(max_batch_size)
+{
+	assert(max_batch_size > 0);
+	assert(!net.layers.empty());
+
+	int max_layer_size = net.input_layer_size;
+
+	values.reserve(net.layers.size() + 1);
+	gradient.reserve(net.layers.size());
+	momentum.reserve(net.layers.size());
+
+	values.emplace_back();
+
+	for (const layer& l : net.layers)
+	{
+		values.emplace_back(l.size, max_batch_size);
+		gradient.emplace_back(l.size, l.prev_layer_size);
+		momentum.emplace_back(l.size, l.prev_layer_size, 0.f);
+
+		max_layer_size = std::max(max_layer_size, l.size);
+	}
+
+	delta = matrix(max_layer_size, max_batch_size);
+	next_delta = matrix(max_layer_size, max_batch_size);
+}
+
 neural_net::neural_net(const char* const file_name)
 {
 	load_from_file(file_name);
 }
 
-matrix neural_net::run(matrix input) const
+// delta = output - required_output, the gradient of the loss with respect to the output
+static void output_delta(const matrix& output, const matrix_view& required_output, matrix& delta)
 {
-	assert(input.get_width() == input_layer_size);
+	assert(required_output.is_alive());
+	assert(output.get_width() == required_output.get_width());
+	assert(output.get_height() == required_output.get_height());
 
-	for (const layer& l : layers)
+	const int width = output.get_width();
+	delta.resize(width, output.get_height());
+
+	for (int i = 0; i < output.get_height(); i++)
 	{
-		input = activation_function(input * l.weights + matrix(1, input.get_height(), 1.f) * l.biases);
+		const float* output_row = output.get_data() + (size_t)i * width;
+		const float* required_row = required_output.row(i);
+		float* delta_row = delta.get_data() + (size_t)i * width;
+
+		for (int j = 0; j < width; j++)
+			delta_row[j] = output_row[j] - required_row[j];
 	}
+}
 
-	return input;
+static size_t get_element_size(const matrix_view&)
+{
+	return sizeof(float);
+}
+
+static size_t get_element_size(const byte_matrix_view&)
+{
+	return sizeof(uint8_t);
+}
+
+template<typename Input, typename Output>
+void neural_net::forward_layer(const layer& l, const Input& input, Output&& output) const
+{
+	const double rows = input.get_height();
+	const double weights_size = (double)l.size * l.prev_layer_size * (precision == weight_precision::fp32 ? sizeof(float) : sizeof(uint16_t));
+	PROFILE_SCOPE("forward", int(&l - layers.data()), 2. * rows * l.size * l.prev_layer_size,
+		weights_size + rows * l.prev_layer_size * get_element_size(input) + rows * l.size * sizeof(float));
+
+	switch (precision)
+	{
+	case weight_precision::fp32:
+		dense_forward(input, l.weights, l.biases, l.f, std::forward<Output>(output));
+		break;
+	case weight_precision::fp16:
+		dense_forward(input, l.half_weights, l.biases, l.f, std::forward<Output>(output));
+		break;
+	case weight_precision::bf16:
+		dense_forward(input, l.bfloat16_weights, l.biases, l.f, std::forward<Output>(output));
+		break;
+	}
+}
+
+void neural_net::run_layer(int layer_index, const matrix_view& input, float* output) const
+{
+	assert(layer_index >= 0 && layer_index < (int)layers.size());
+	assert(input.get_width() == layers[layer_index].prev_layer_size);
+
+	forward_layer(layers[layer_index], input, output);
+}
+
+void neural_net::set_weight_precision(weight_precision new_precision)
+{
+	if (new_precision == precision) return;
+
+	for (layer& l : layers)
+	{
+		// Going between the 16-bit formats goes through floats, which hold all their values
+		if (precision == weight_precision::fp16)
+			l.weights = l.half_weights.to_matrix();
+		else if (precision == weight_precision::bf16)
+			l.weights = l.bfloat16_weights.to_matrix();
+		l.half_weights = half_matrix();
+		l.bfloat16_weights = bfloat16_matrix();
+
+		if (new_precision == weight_precision::fp16)
+			l.half_weights = half_matrix(l.weights);
+		else if (new_precision == weight_precision::bf16)
+			l.bfloat16_weights = bfloat16_matrix(l.weights);
+		if (new_precision != weight_precision::fp32)
+			l.weights = matrix();
+	}
+
+	precision = new_precision;
+}
+
+void neural_net::set_parameters(int layer_index, const float* weights, const float* biases)
+{
+	assert(precision == weight_precision::fp32);
+	assert(layer_index >= 0 && layer_index < (int)layers.size());
+	assert(weights && biases);
+
+	layer& l = layers[layer_index];
+	memcpy(l.weights.get_data(), weights, (size_t)l.size * l.prev_layer_size * sizeof(float));
+	memcpy(l.biases.get_data(), biases, (size_t)l.size * sizeof(float));
+}
+
+matrix neural_net::run_hidden_layers(matrix output) const
+{
+	matrix next_output;
+	for (size_t i = 1; i < layers.size(); i++)
+	{
+		forward_layer(layers[i], output, next_output);
+		std::swap(output, next_output);
+	}
+
+	return output;
 }
 
-std::vector<matrix> neural_net::run_ext_output(matrix input) const
+matrix neural_net::run(const matrix_view& input) const
 {
 	assert(input.get_width() == input_layer_size);
+	PROFILE_SCOPE("run");
+
+	matrix output;
+	forward_layer(layers[0], input, output);
+
+	return run_hidden_layers(std::move(output));
+}
+
+matrix neural_net::run(const byte_matrix_view& input) const
+{
+	assert(input.get_width() == input_layer_size);
+	PROFILE_SCOPE("run");
+
+	matrix output;
+	forward_layer(layers[0], input, output);
+
+	return run_hidden_layers(std::move(output));
+}
+
+std::vector<matrix> neural_net::run_ext_output(const matrix_view& input) const
+{
+	assert(input.get_width() == input_layer_size);
+	PROFILE_SCOPE("run_ext_output");
 
 	std::vector<matrix> result;
 	result.reserve(layers.size() + 1);
-	result.push_back(std::move(input));
+	result.emplace_back(input);
 
 	for (const layer& l : layers)
 	{
-		result.push_back(activation_function(result.back() * l.weights + matrix(1, input.get_height(), 1.f) * l.biases));
+		matrix output;
+		forward_layer(l, result.back(), output);
+		result.push_back(std::move(output));
 	}
 
 	return result;
 }
 
-std::vector<neural_net::layer> neural_net::backpropagation(const matrix& input, const matrix& required_output)
+void neural_net::run_ext_output(const matrix_view& input, training_workspace& ws) const
 {
+	assert(input.get_width() == input_layer_size);
+	assert(input.get_height() <= ws.max_batch_size);
+	assert(ws.values.size() == layers.size() + 1);
+	PROFILE_SCOPE("run_ext_output");
+
+	ws.input = input;
+	ws.byte_input = byte_matrix_view();
+
+	forward_layer(layers[0], input, ws.values[1]);
+	run_hidden_layers(ws);
+}
+
+void neural_net::run_ext_output(const byte_matrix_view& input, training_workspace& ws) const
+{
+	assert(input.get_width() == input_layer_size);
+	assert(input.get_height() <= ws.max_batch_size);
+	assert(ws.values.size() == layers.size() + 1);
+	PROFILE_SCOPE("run_ext_output");
+
+	ws.input = matrix_view();
+	ws.byte_input = input;
+
+	forward_layer(layers[0], input, ws.values[1]);
+	run_hidden_layers(ws);
+}
+
+void neural_net::run_hidden_layers(training_workspace& ws) const
+{
+	for (size_t i = 1; i < layers.size(); i++)
+	{
+		forward_layer(layers[i], ws.values[i], ws.values[i + 1]);
+	}
+}
+
+std::vector<neural_net::layer> neural_net::backpropagation(const matrix_view& input, const matrix_view& required_output)
+{
+	assert(precision == weight_precision::fp32);
 	assert(input.is_alive() && required_output.is_alive());
 	assert(input.get_width() == input_layer_size);
 	assert(required_output.get_width() == layers.back().size);
 	assert(required_output.get_height() == input.get_height());
+	PROFILE_SCOPE("backpropagation");
 
 	std::vector<matrix> values = run_ext_output(input); // Calculate initial neurons activation values
 	std::vector<layer> gradient(layers.size());
 
-	matrix x = values.back() - required_output; // Delta
+	matrix x;
+	output_delta(values.back(), required_output, x); // Delta
 
 	for (int i = layers.size(); i > 0; i--) // For every layer starting from the last
 	{
-		x = hadamard_product(x, activation_function_derivative(values[i])); // Activation function derivative
+		const double layer_flops = 2. * x.get_height() * layers[i - 1].size * layers[i - 1].prev_layer_size;
+		PROFILE_SCOPE("backward", i - 1, 2. * layer_flops);
 		gradient[i - 1].size = layers[i - 1].size;
 		gradient[i - 1].prev_layer_size = layers[i - 1].prev_layer_size;
+		dense_backward(x, values[i], layers[i - 1].f, gradient[i - 1].biases); // Activation function and biases partial derivatives
 		gradient[i - 1].weights = transpose(values[i - 1]) * x; // Weights partial derivative
-		gradient[i - 1].biases = matrix(input.get_height(), 1, 1.f) * x; // Biases partial derivative
-		x = transpose(layers[i - 1].weights * transpose(x)); // Neuron connection partial derivative
+		x = x * transpose(layers[i - 1].weights); // Neuron connection partial derivative
 	}
 
 	return gradient;
 }
 
-void neural_net::backpropagation(const matrix& input, const matrix& required_output, float rate)
+void neural_net::backpropagation(const matrix_view& input, const matrix_view& required_output, float rate)
 {
+	assert(precision == weight_precision::fp32);
 	assert(input.is_alive() && required_output.is_alive());
 	assert(input.get_width() == input_layer_size);
 	assert(required_output.get_width() == layers.back().size);
 	assert(required_output.get_height() == input.get_height());
 
+	PROFILE_SCOPE("backpropagation");
+
 	std::vector<matrix> values = run_ext_output(input); // Calculate initial neurons activation values
 
-	matrix x = values.back() - required_output; // Delta
+	matrix x;
+	output_delta(values.back(), required_output, x); // Delta
+	matrix biases_derivative;
 
 	for (int i = layers.size(); i > 0; i--) // For every layer starting from the last
 	{
-		x = hadamard_product(x, activation_function_derivative(values[i])); // Activation function derivative
+		const double layer_flops = 2. * x.get_height() * layers[i - 1].size * layers[i - 1].prev_layer_size;
+		PROFILE_SCOPE("backward", i - 1, 2. * layer_flops);
+		dense_backward(x, values[i], layers[i - 1].f, biases_derivative); // Activation function and biases partial derivatives
 		matrix weights_derivative = transpose(values[i - 1]) * x; // Weights partial derivative
-		layers[i - 1].biases = layers[i - 1].biases - matrix(input.get_height(), 1, 1.f) * x * rate; // Biases partial derivative
-		x = transpose(layers[i - 1].weights * transpose(x)); // Neuron connection partial derivative
+		layers[i - 1].biases = layers[i - 1].biases - biases_derivative * rate;
+		x = x * transpose(layers[i - 1].weights); // Neuron connection partial derivative
 		layers[i - 1].weights = layers[i - 1].weights - weights_derivative * rate;
 	}
 }
 
-void neural_net::train_batch(const matrix& input, const matrix& required_output, int iter_num, float rate)
+void neural_net::backpropagation(const matrix_view& input, const matrix_view& required_output, training_workspace& ws) const
+{
+	assert(input.is_alive() && required_output.is_alive());
+	assert(required_output.get_height() == input.get_height());
+	PROFILE_SCOPE("backpropagation");
+
+	run_ext_output(input, ws); // Calculate initial neurons activation values
+	backpropagate_output(required_output, ws);
+}
+
+void neural_net::backpropagation(const byte_matrix_view& input, const matrix_view& required_output, training_workspace& ws) const
+{
+	assert(input.is_alive() && required_output.is_alive());
+	assert(required_output.get_height() == input.get_height());
+	PROFILE_SCOPE("backpropagation");
+
+	run_ext_output(input, ws); // Calculate initial neurons activation values
+	backpropagate_output(required_output, ws);
+}
+
+void neural_net::backpropagate_output(const matrix_view& required_output, training_workspace& ws) const
+{
+	assert(precision == weight_precision::fp32);
+	assert(required_output.get_width() == layers.back().size);
+
+	output_delta(ws.values.back(), required_output, ws.delta); // Delta
+
+	for (int i = layers.size(); i > 0; i--) // For every layer starting from the last
+	{
+		// The weights gradient, and the delta of the previous layer unless this is the first one
+		const double layer_flops = 2. * ws.delta.get_height() * layers[i - 1].size * layers[i - 1].prev_layer_size;
+		PROFILE_SCOPE("backward", i - 1, i > 1 ? 2. * layer_flops : layer_flops);
+
+		dense_backward(ws.delta, ws.values[i], layers[i - 1].f, ws.gradient[i - 1].biases); // Activation function and biases partial derivatives
+
+		// Weights partial derivative
+		if (i > 1)
+			multiply(ws.values[i - 1], true, ws.delta, false, ws.gradient[i - 1].weights);
+		else if (ws.byte_input.is_alive())
+			multiply(ws.byte_input, true, ws.delta, false, ws.gradient[i - 1].weights);
+		else
+			multiply(ws.input, true, ws.delta, false, ws.gradient[i - 1].weights);
+
+		if (i > 1)
+		{
+			multiply(ws.delta, transpose(layers[i - 1].weights), ws.next_delta); // Neuron connection partial derivative
+			std::swap(ws.delta, ws.next_delta);
+		}
+	}
+}
+
+void neural_net::backpropagation(const matrix_view& input, const matrix_view& required_output, float rate, training_workspace& ws)
+{
+	backpropagation(input, required_output, ws);
+	apply_gradient(ws, rate);
+}
+
+void neural_net::backpropagation(const byte_matrix_view& input, const matrix_view& required_output, float rate, training_workspace& ws)
+{
+	backpropagation(input, required_output, ws);
+	apply_gradient(ws, rate);
+}
+
+void neural_net::apply_gradient(const training_workspace& ws, float rate)
+{
+	assert(ws.gradient.size() == layers.size());
+	PROFILE_SCOPE("apply_gradient");
+
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		axpby(-rate, ws.gradient[i].weights, 1.f, layers[i].weights);
+		axpby(-rate, ws.gradient[i].biases, 1.f, layers[i].biases);
+	}
+}
+
+void neural_net::apply_sparse_gradient(const training_workspace& ws, float rate)
+{
+	assert(ws.gradient.size() == layers.size());
+	assert(ws.input.get_height() == 1);
+
+	const kernel_table& kernel = kernels();
+
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		layer& l = layers[i];
+		const matrix_view layer_input = i == 0 ? ws.input : matrix_view(ws.values[i]);
+		const matrix& weights_gradient = ws.gradient[i].weights;
+
+		// Row j of the weights gradient is input[j] * delta
+		for (int j = 0; j < l.prev_layer_size; j++)
+		{
+			if (layer_input.at(0, j) == 0.f) continue;
+
+			kernel.axpby(l.size, -rate, weights_gradient.get_data() + (size_t)j * l.size, 1.f, l.weights.get_data() + (size_t)j * l.size);
+		}
+
+		kernel.axpby(l.size, -rate, ws.gradient[i].biases.get_data(), 1.f, l.biases.get_data());
+	}
+}
+
+void neural_net::train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate)
 {
 	assert(input.is_alive() && required_output.is_alive());
 	assert(input.get_width() == input_layer_size);
@@ -128,7 +442,29 @@ void neural_net::train_batch(const matrix& input, const matrix& required_output,
 	}
 }
 
-void neural_net::train_stochastic(const matrix& input, const matrix& required_output, int iter_num, float rate)
+void neural_net::train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws)
+{
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	for (int i = 0; i < iter_num; i++)
+	{
+		backpropagation(input, required_output, rate, ws);
+	}
+}
+
+void neural_net::train_batch(const byte_matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws)
+{
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	for (int i = 0; i < iter_num; i++)
+	{
+		backpropagation(input, required_output, rate, ws);
+	}
+}
+
+void neural_net::train_stochastic(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate)
 {
 	assert(input.is_alive() && required_output.is_alive());
 	assert(input.get_width() == input_layer_size);
@@ -139,13 +475,13 @@ void neural_net::train_stochastic(const matrix& input, const matrix& required_ou
 
 	const int num_samples = input.get_height();
 
-	static std::vector<layer> grad = backpropagation(input.submatrix(0, 1), required_output.submatrix(0, 1));
+	static std::vector<layer> grad = backpropagation(input.rows(0, 1), required_output.rows(0, 1));
 
 	const float fraction = 0.7f;
 	for (int i = 0; i < iter_num; i++)
 	{
 		const unsigned sample_index = random_int(0, num_samples - 1);
-		auto new_grad = backpropagation(input.submatrix(sample_index, sample_index+1), required_output.submatrix(sample_index, sample_index+1));
+		auto new_grad = backpropagation(input.rows(sample_index, sample_index + 1), required_output.rows(sample_index, sample_index + 1));
 
 		for (int j = 0; j < (int)layers.size(); j++)
 		{
@@ -173,33 +509,318 @@ void neural_net::train_mini_batch(const std::vector<matrix>& input, const std::v
 	}
 }
 
+void neural_net::train_hogwild(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate, int num_threads)
+{
+	assert(precision == weight_precision::fp32);
+	assert(input.is_alive() && required_output.is_alive());
+	assert(input.get_width() == input_layer_size);
+	assert(required_output.get_width() == layers.back().size);
+	assert(required_output.get_height() == input.get_height());
+	assert(rate > 0);
+	assert(iter_num > 0);
+	assert(num_threads > 0);
+
+	const int num_samples = input.get_height();
+
+	auto worker = [&](int thread_index, unsigned long long seed)
+	{
+		// The shared generator of random_int isn't thread safe
+		std::mt19937_64 generator(seed);
+		std::uniform_int_distribution<int> sample_distribution(0, num_samples - 1);
+
+		training_workspace ws(*this, 1);
+
+		const int thread_iter_num = iter_num / num_threads + (thread_index < iter_num % num_threads ? 1 : 0);
+		for (int i = 0; i < thread_iter_num; i++)
+		{
+			const int sample_index = sample_distribution(generator);
+
+			// Reads the weights while other threads update them, see the declaration
+			backpropagation(input.rows(sample_index, sample_index + 1), required_output.rows(sample_index, sample_index + 1), ws);
+			apply_sparse_gradient(ws, rate);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads - 1);
+	for (int t = 1; t < num_threads; t++)
+		threads.emplace_back(worker, t, (unsigned long long)random_int(0, INT32_MAX));
+
+	worker(0, (unsigned long long)random_int(0, INT32_MAX));
+
+	for (std::thread& t : threads)
+		t.join();
+}
+
+void neural_net::train_stochastic(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws)
+{
+	train_stochastic_samples(input, required_output, iter_num, rate, ws);
+}
+
+void neural_net::train_stochastic(const byte_matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws)
+{
+	train_stochastic_samples(input, required_output, iter_num, rate, ws);
+}
+
+template<typename Input>
+void neural_net::train_stochastic_samples(const Input& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws)
+{
+	assert(input.is_alive() && required_output.is_alive());
+	assert(input.get_width() == input_layer_size);
+	assert(required_output.get_width() == layers.back().size);
+	assert(required_output.get_height() == input.get_height());
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	const int num_samples = input.get_height();
+
+	const float fraction = 0.7f;
+	for (int i = 0; i < iter_num; i++)
+	{
+		const int sample_index = random_int(0, num_samples - 1);
+		backpropagation(input.rows(sample_index, sample_index + 1), required_output.rows(sample_index, sample_index + 1), ws);
+
+		for (int j = 0; j < (int)layers.size(); j++)
+		{
+			axpby(rate, ws.gradient[j].weights, fraction, ws.momentum[j].weights);
+			axpby(rate, ws.gradient[j].biases, fraction, ws.momentum[j].biases);
+
+			axpby(-1.f, ws.momentum[j].weights, 1.f, layers[j].weights);
+			axpby(-1.f, ws.momentum[j].biases, 1.f, layers[j].biases);
+		}
+	}
+}
+
+void neural_net::train_mini_batch(const std::vector<matrix>& input, const std::vector<matrix>& required_output, int iter_num, float rate, training_workspace& ws)
+{
+	assert(input.size() == required_output.size());
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	const int num_batches = (int)input.size();
+
+	for (int i = 0; i < iter_num; i++)
+	{
+		const int batch_index = random_int(0, num_batches - 1);
+		backpropagation(input[batch_index], required_output[batch_index], rate, ws);
+	}
+}
+
+void neural_net::train_mini_batch(const matrix_view& input, const matrix_view& required_output, int batch_size, int iter_num, float rate, training_workspace& ws)
+{
+	train_mini_batch_rows(input, required_output, batch_size, iter_num, rate, ws);
+}
+
+void neural_net::train_mini_batch(const byte_matrix_view& input, const matrix_view& required_output, int batch_size, int iter_num, float rate, training_workspace& ws)
+{
+	train_mini_batch_rows(input, required_output, batch_size, iter_num, rate, ws);
+}
+
+template<typename Input>
+void neural_net::train_mini_batch_rows(const Input& input, const matrix_view& required_output, int batch_size, int iter_num, float rate, training_workspace& ws)
+{
+	assert(input.is_alive() && required_output.is_alive());
+	assert(required_output.get_height() == input.get_height());
+	assert(batch_size > 0 && batch_size <= input.get_height() && batch_size <= ws.max_batch_size);
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	const int num_samples = input.get_height();
+
+	for (int i = 0; i < iter_num; i++)
+	{
+		const int row_a = random_int(0, num_samples - batch_size);
+		backpropagation(input.rows(row_a, row_a + batch_size), required_output.rows(row_a, row_a + batch_size), rate, ws);
+	}
+}
+
+//Version 3 model files have every field 4 bytes wide and the weights and biases of every layer
+//at a 64 byte boundary, so that a mapped file can be used in place
+static constexpr uint32_t model_magic_v3 = 0x0023029Au;
+static constexpr size_t model_alignment = 64;
+
+struct model_header_v3
+{
+	uint32_t magic_number;
+	uint8_t little_endian;
+	uint8_t padding[3];
+	int32_t num_layers;
+	int32_t data_offset; // Start of the first layer's weights
+	int32_t precision; // weight_precision of the weights, zero (fp32) in files that predate it
+	int32_t reserved[3]; // Zero, for future extensions
+	// Followed by num_layers layer sizes and num_layers - 1 activation functions
+};
+
+static_assert(sizeof(model_header_v3) == 32, "model_header_v3 must have no padding");
+
+// Checks the num_layers - 1 activation functions of a model file, softmax is only supported in the last layer
+static bool are_activations_valid(const int32_t* activations, int num_layers)
+{
+	for (int i = 0; i < num_layers - 1; i++)
+	{
+		if (!is_activation(activations[i]) || (activations[i] == (int32_t)activation::softmax && i != num_layers - 2))
+			return false;
+	}
+	return true;
+}
+
+// Locations of the layers in a version 3 file
+struct model_layout_v3
+{
+	const int32_t* layer_sizes = nullptr;
+	const int32_t* activations = nullptr;
+	weight_precision precision = weight_precision::fp32;
+	std::vector<char*> weights; // Values of the precision
+	std::vector<float*> biases;
+};
+
+static size_t get_weight_size(weight_precision precision)
+{
+	return precision == weight_precision::fp32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+static void swap_byte_order(char* data, size_t size, size_t value_size)
+{
+	for (char* i = data; i < data + size; i += value_size)
+		swap_byte_order(i, value_size);
+}
+
+static size_t align_model_offset(size_t offset)
+{
+	return (offset + model_alignment - 1) / model_alignment * model_alignment;
+}
+
+static void write_model_padding(std::ofstream& f)
+{
+	static const char zeros[model_alignment] = {};
+	const size_t position = (size_t)f.tellp();
+	f.write(zeros, (std::streamsize)(align_model_offset(position) - position));
+}
+
+static bool is_model_v3(const char* data, size_t size)
+{
+	if (size < sizeof(model_header_v3)) return false;
+	const uint32_t magic_number = *reinterpret_cast<const uint32_t*>(data);
+	return magic_number == model_magic_v3 || magic_number == (uint32_t)0x9A022300;
+}
+
+// Checks a version 3 file, converts it to the native byte order in place if needed and finds the layers
+static bool parse_model_v3(char* data, size_t size, model_layout_v3& layout)
+{
+	if (!is_model_v3(data, size) || size % 4 != 0) return false;
+
+	model_header_v3* header = reinterpret_cast<model_header_v3*>(data);
+
+	//If endianness doesn't match, every field is swapped once its extent is checked, as 16-bit weights are swapped in pairs of bytes
+	const bool swap = (header->little_endian != 0) != is_little_endian();
+	if (swap)
+	{
+		swap_byte_order(data + offsetof(model_header_v3, num_layers), sizeof(model_header_v3) - offsetof(model_header_v3, num_layers), 4);
+		header->little_endian = is_little_endian();
+	}
+
+	const int num_layers = header->num_layers;
+	const size_t data_offset = (size_t)header->data_offset;
+	if (num_layers < 2 || data_offset % model_alignment != 0 || data_offset > size ||
+		sizeof(model_header_v3) + 4 * (2 * (size_t)num_layers - 1) > data_offset ||
+		header->precision < (int32_t)weight_precision::fp32 || header->precision > (int32_t)weight_precision::bf16)
+		return false;
+
+	if (swap)
+		swap_byte_order(data + sizeof(model_header_v3), 4 * (2 * (size_t)num_layers - 1), 4);
+
+	layout.layer_sizes = reinterpret_cast<const int32_t*>(data + sizeof(model_header_v3));
+	layout.activations = layout.layer_sizes + num_layers;
+	if (!are_activations_valid(layout.activations, num_layers)) return false;
+	layout.precision = (weight_precision)header->precision;
+	layout.weights.clear();
+	layout.biases.clear();
+
+	const size_t weight_size = get_weight_size(layout.precision);
+	size_t offset = data_offset;
+	for (int i = 1; i < num_layers; i++)
+	{
+		if (layout.layer_sizes[i] <= 0 || layout.layer_sizes[i - 1] <= 0) return false;
+
+		const size_t weights_size = (size_t)layout.layer_sizes[i] * layout.layer_sizes[i - 1] * weight_size;
+		const size_t biases_size = (size_t)layout.layer_sizes[i] * sizeof(float);
+		if (offset + weights_size > size) return false;
+		if (swap) swap_byte_order(data + offset, weights_size, weight_size);
+		layout.weights.push_back(data + offset);
+		offset = align_model_offset(offset + weights_size);
+
+		if (offset + biases_size > size) return false;
+		if (swap) swap_byte_order(data + offset, biases_size, 4);
+		layout.biases.push_back(reinterpret_cast<float*>(data + offset));
+		offset = align_model_offset(offset + biases_size);
+	}
+
+	return true;
+}
+
+// The model is written next to the file and renamed over it, so a net mapped from file_name keeps reading the old file
+// until it's unmapped, and a failed save leaves the previous model in place
 bool neural_net::save_to_file(const char* const file_name)
+{
+	const std::string temp_name = std::string(file_name) + ".tmp";
+	if (!write_model(temp_name.c_str()))
+	{
+		std::remove(temp_name.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	//rename doesn't replace existing files on Windows
+	std::remove(file_name);
+#endif
+	if (std::rename(temp_name.c_str(), file_name) != 0)
+	{
+		std::remove(temp_name.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool neural_net::write_model(const char* const file_name) const
 {
 	std::ofstream f(file_name, std::ios::binary | std::ios::trunc);
 	if (!f.is_open()) return false;
-	//Magic number
-	write_var(f, (uint32_t)0x00230298u);
-	//Is little endian
-	write_var(f, is_little_endian());
-	//Number of layers
-	write_var(f, int32_t(layers.size() + 1));
+
+	const int32_t num_layers = int32_t(layers.size() + 1);
+
+	//Header, version 3
+	model_header_v3 header = {};
+	header.magic_number = model_magic_v3;
+	header.little_endian = is_little_endian();
+	header.num_layers = num_layers;
+	header.data_offset = (int32_t)align_model_offset(sizeof(model_header_v3) + 4 * (2 * (size_t)num_layers - 1));
+	header.precision = (int32_t)precision;
+	write_var(f, header);
 	//Input layer size
 	write_var(f, (int32_t)input_layer_size);
 	//Other layers sizes
 	for (const layer& l : layers)
 		write_var(f, (int32_t)l.size);
-	//Weights and biases
+	//Activation functions
+	for (const layer& l : layers)
+		write_var(f, (int32_t)l.f);
+	write_model_padding(f);
+	//Weights and biases, each aligned
 	for (const layer& l : layers)
 	{
-		//Weights
-		f.write(reinterpret_cast<const char*>(l.weights.get_data()),
-			(std::streamsize)l.weights.get_width() * l.weights.get_height() * sizeof(float));
+		//Weights, in their precision
+		const char* weights = precision == weight_precision::fp16 ? reinterpret_cast<const char*>(l.half_weights.get_data())
+			: precision == weight_precision::bf16 ? reinterpret_cast<const char*>(l.bfloat16_weights.get_data())
+			: reinterpret_cast<const char*>(l.weights.get_data());
+		f.write(weights, (std::streamsize)((size_t)l.size * l.prev_layer_size * get_weight_size(precision)));
+		write_model_padding(f);
 		//Biases
 		f.write(reinterpret_cast<const char*>(l.biases.get_data()),
 			(std::streamsize)l.biases.get_width() * sizeof(float));
+		write_model_padding(f);
 	}
 
-	return true;
+	return f.good();
 }
 
 bool neural_net::load_from_file(const char* const file_name)
@@ -209,11 +830,60 @@ bool neural_net::load_from_file(const char* const file_name)
 	if (!net_data.get_data()) return false;
 	char* file_pointer = net_data.get_data();
 
+	if (is_model_v3(net_data.get_data(), net_data.get_size()))
+	{
+		model_layout_v3 layout;
+		if (!parse_model_v3(net_data.get_data(), net_data.get_size(), layout))
+			return false;
+
+		const int num_layers = (int)layout.weights.size() + 1;
+		input_layer_size = layout.layer_sizes[0];
+
+		layers.clear();
+		layers.reserve(num_layers - 1);
+		mapping.reset();
+		precision = layout.precision;
+
+		for (int i = 1; i < num_layers; i++)
+		{
+			const int size = layout.layer_sizes[i];
+			const int prev_layer_size = layout.layer_sizes[i - 1];
+			const activation f = (activation)layout.activations[i - 1];
+
+			// 16-bit weights take the place of the float ones
+			layer& l = precision == weight_precision::fp32 ? layers.emplace_back(size, prev_layer_size, f) : layers.emplace_back();
+			if (precision == weight_precision::fp32)
+			{
+				memcpy(l.weights.get_data(), layout.weights[i - 1], (size_t)size * prev_layer_size * sizeof(float));
+			}
+			else
+			{
+				l.size = size;
+				l.prev_layer_size = prev_layer_size;
+				l.f = f;
+				l.biases = matrix(size, 1);
+				if (precision == weight_precision::fp16)
+					l.half_weights = half_matrix(reinterpret_cast<const float16*>(layout.weights[i - 1]), size, prev_layer_size);
+				else
+					l.bfloat16_weights = bfloat16_matrix(reinterpret_cast<const bfloat16*>(layout.weights[i - 1]), size, prev_layer_size);
+			}
+			memcpy(l.biases.get_data(), layout.biases[i - 1], (size_t)size * sizeof(float));
+		}
+
+		return true;
+	}
+
 	//Magic number
 	const uint32_t magic_number = *reinterpret_cast<unsigned*>(file_pointer);
 	file_pointer += sizeof(unsigned);
 
-	if (magic_number != (uint32_t)0x00230298 && magic_number != (uint32_t)0x98022300)
+	//Version 1 files have no activation functions, all their layers are sigmoid
+	int version;
+	if (magic_number == (uint32_t)0x00230298 || magic_number == (uint32_t)0x98022300)
+		version = 1;
+	else if (magic_number == (uint32_t)0x00230299 || magic_number == (uint32_t)0x99022300)
+		version = 2;
+	else
 		return false;
 
 	const bool little_endian = *reinterpret_cast<bool*>(file_pointer);
@@ -235,14 +905,25 @@ bool neural_net::load_from_file(const char* const file_name)
 	const int32_t* layers_sizes = reinterpret_cast<int32_t*>(file_pointer);
 	file_pointer += 4 * num_layers;
 
+	const int32_t* activations = nullptr;
+	if (version >= 2)
+	{
+		activations = reinterpret_cast<int32_t*>(file_pointer);
+		file_pointer += 4 * (num_layers - 1);
+		if (!are_activations_valid(activations, num_layers)) return false;
+	}
+
 	input_layer_size = layers_sizes[0];
 
 	layers.clear();
 	layers.reserve(num_layers - 1);
+	mapping.reset();
+	precision = weight_precision::fp32;
 
 	for (int i = 1; i < num_layers; i++)
 	{
-		layer& l = layers.emplace_back(layers_sizes[i], layers_sizes[i - 1]);
+		const activation f = activations ? (activation)activations[i - 1] : activation::sigmoid;
+		layer& l = layers.emplace_back(layers_sizes[i], layers_sizes[i - 1], f);
 
 		const size_t weights_size = (size_t)l.weights.get_width() * l.weights.get_height() * sizeof(float);;
 		memcpy(l.weights.get_data(), file_pointer, weights_size);
@@ -256,6 +937,65 @@ bool neural_net::load_from_file(const char* const file_name)
 	return true;
 }
 
+bool neural_net::map_from_file(const char* const file_name)
+{
+	std::shared_ptr<mapped_file> file = std::make_shared<mapped_file>();
+	if (!file->open(file_name)) return false;
+
+	if (!is_model_v3(file->get_data(), file->get_size()))
+		return load_from_file(file_name);
+
+	// Only pages that need byte swapping get copied
+	model_layout_v3 layout;
+	if (!parse_model_v3(file->get_data(), file->get_size(), layout))
+		return false;
+
+	const int num_layers = (int)layout.weights.size() + 1;
+	input_layer_size = layout.layer_sizes[0];
+
+	layers.clear();
+	layers.reserve(num_layers - 1);
+
+	for (int i = 1; i < num_layers; i++)
+	{
+		const int size = layout.layer_sizes[i];
+		const int prev_layer_size = layout.layer_sizes[i - 1];
+		const activation f = (activation)layout.activations[i - 1];
+		matrix biases = matrix::wrap(layout.biases[i - 1], size, 1);
+
+		switch (layout.precision)
+		{
+		case weight_precision::fp32:
+			layers.emplace_back(size, prev_layer_size, f, matrix::wrap(reinterpret_cast<float*>(layout.weights[i - 1]), size, prev_layer_size), std::move(biases));
+			break;
+		case weight_precision::fp16:
+		{
+			layer& l = layers.emplace_back();
+			l.size = size;
+			l.prev_layer_size = prev_layer_size;
+			l.f = f;
+			l.biases = std::move(biases);
+			l.half_weights = half_matrix::wrap(reinterpret_cast<const float16*>(layout.weights[i - 1]), size, prev_layer_size);
+			break;
+		}
+		case weight_precision::bf16:
+		{
+			layer& l = layers.emplace_back();
+			l.size = size;
+			l.prev_layer_size = prev_layer_size;
+			l.f = f;
+			l.biases = std::move(biases);
+			l.bfloat16_weights = bfloat16_matrix::wrap(reinterpret_cast<const bfloat16*>(layout.weights[i - 1]), size, prev_layer_size);
+			break;
+		}
+		}
+	}
+
+	precision = layout.precision;
+	mapping = std::move(file);
+	return true;
+}
+
 float neural_net::calculate_error(matrix values, matrix required_values)
 {
 	matrix delta = required_values - values;
@@ -271,18 +1011,36 @@ float neural_net::calculate_error(matrix values, matrix required_values)
 
 matrix neural_net::activation_function(matrix input)
 {
-	for (size_t i = 0; i < (size_t)input.get_height() * input.get_width(); i++)
-	{
-		input.at(i) = sigmoid(input.at(i));
-	}
+	activation_function(input, input);
 	return input;
 }
 
 matrix neural_net::activation_function_derivative(matrix input)
 {
+	activation_function_derivative(input, input);
+	return input;
+}
+
+void neural_net::activation_function(const matrix& input, matrix& result)
+{
+	const double size = (double)input.get_width() * input.get_height();
+	PROFILE_SCOPE("activation_function", -1, 0., 2. * size * sizeof(float));
+
+	if (&result != &input)
+		result = input;
+
+	activate(activation::sigmoid, result.get_data(), (size_t)result.get_width() * result.get_height());
+}
+
+void neural_net::activation_function_derivative(const matrix& input, matrix& result)
+{
+	const double size = (double)input.get_width() * input.get_height();
+	PROFILE_SCOPE("activation_function_derivative", -1, 0., 2. * size * sizeof(float));
+
+	result.resize(input.get_width(), input.get_height());
+
 	for (size_t i = 0; i < (size_t)input.get_height() * input.get_width(); i++)
 	{
-		input.at(i) = sigmoid_derivative(input.at(i));
+		result.at(i) = sigmoid_derivative(input.at(i));
 	}
-	return input;
 }
@@ -1,8 +1,15 @@
 #pragma once
 #include <vector>
 #include <fstream>
+#include <cmath>
+#include <memory>
 
 #include "matrix.h"
+#include "byte_matrix.h"
+#include "half_matrix.h"
+#include "activation.h"
+
+class mapped_file;
 
 class neural_net
 {
@@ -17,12 +24,18 @@ private:
 	{
 		int size = 0;
 		int prev_layer_size = 0;
+		activation f = activation::sigmoid;
 		matrix weights;
 		matrix biases;
+		// Used instead of weights when they are kept in 16 bits, see set_weight_precision
+		half_matrix half_weights;
+		bfloat16_matrix bfloat16_weights;
 
 		layer() = default;
 		layer(int size, int prev_layer_size) : size(size), prev_layer_size(prev_layer_size), weights(size, prev_layer_size), biases(size, 1) {}
+		layer(int size, int prev_layer_size, activation f) : size(size), prev_layer_size(prev_layer_size), f(f), weights(size, prev_layer_size), biases(size, 1) {}
 		layer(int size, int prev_layer_size, float init_val) : size(size), prev_layer_size(prev_layer_size), weights(size, prev_layer_size, init_val), biases(size, 1, init_val) {}
+		layer(int size, int prev_layer_size, activation f, matrix&& weights, matrix&& biases) : size(size), prev_layer_size(prev_layer_size), f(f), weights(std::move(weights)), biases(std::move(biases)) {}
 
 
 		void init();
@@ -30,30 +43,183 @@ private:
 
 	std::vector<layer> layers;
 	int input_layer_size;
+	weight_precision precision = weight_precision::fp32;
+
+	// Model file the weights point into after map_from_file
+	std::shared_ptr<mapped_file> mapping;
+
+	// Runs the layers on its own threads
+	friend class pipeline_trainer;
+
+	// Forward pass of one layer with the weights in the precision they are kept in
+	template<typename Input, typename Output>
+	void forward_layer(const layer& l, const Input& input, Output&& output) const;
+
+	// Runs the layers after the first one on its output
+	matrix run_hidden_layers(matrix output) const;
+
+public:
+	// Preallocated buffers for training, sized once for the topology and the maximum batch size,
+	// so that steady-state training doesn't allocate
+	struct training_workspace
+	{
+		int max_batch_size = 0;
+		matrix_view input; // The batch of the last forward pass, read in place
+		byte_matrix_view byte_input; // Used instead of input for a batch of bytes
+		std::vector<matrix> values; // Neurons activation values, values[i] is the output of layer i - 1 and values[0] is unused
+		std::vector<layer> gradient;
+		std::vector<layer> momentum; // Used by train_stochastic
+		matrix delta;
+		matrix next_delta;
+
+		training_workspace(const neural_net& net, int max_batch_size);
+	};
+
+private:
+	// Forward pass from ws.values[1], backward pass from the output, shared by the float and byte inputs
+	void run_hidden_layers(training_workspace& ws) const;
+
+	void backpropagate_output(const matrix_view& required_output, training_workspace& ws) const;
+
+	template<typename Input>
+	void train_stochastic_samples(const Input& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws);
+
+	// Writes the model, version 3, to file_name
+	bool write_model(const char* const file_name) const;
+
+	template<typename Input>
+	void train_mini_batch_rows(const Input& input, const matrix_view& required_output, int batch_size, int iter_num, float rate, training_workspace& ws);
 
 public:
 
 	neural_net(const int num_layers, const int* const layer_sizes);
+
+	// layer_activations holds num_layers - 1 functions, one for every layer after the input.
+	// Softmax is only supported in the last layer, where it is trained with the cross-entropy loss.
+	neural_net(const int num_layers, const int* const layer_sizes, const activation* const layer_activations);
 	neural_net(const char* const file_name);
 
-	matrix run(matrix input) const;
+	// The inputs and required outputs below are views, so ranges of rows of a dataset are used without copying them
+	matrix run(const matrix_view& input) const;
 
-	std::vector<matrix> run_ext_output(matrix input) const;
+	std::vector<matrix> run_ext_output(const matrix_view& input) const;
 
-	std::vector<layer> backpropagation(const matrix& input, const matrix& required_output);
+	// Calculates activation values of every layer into ws.values, the input must stay alive until the backward pass
+	void run_ext_output(const matrix_view& input, training_workspace& ws) const;
 
-	void backpropagation(const matrix& input, const matrix& required_output, float rate);
+	// Versions for datasets kept as bytes, see byte_matrix_view. The first layer converts them while multiplying.
+	matrix run(const byte_matrix_view& input) const;
 
-	void train_batch(const matrix& input, const matrix& required_output, int iter_num, float rate);
+	void run_ext_output(const byte_matrix_view& input, training_workspace& ws) const;
 
-	void train_stochastic(const matrix& input, const matrix& required_output, int iter_num, float rate);
+	void backpropagation(const byte_matrix_view& input, const matrix_view& required_output, training_workspace& ws) const;
+
+	void backpropagation(const byte_matrix_view& input, const matrix_view& required_output, float rate, training_workspace& ws);
+
+	void train_batch(const byte_matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws);
+
+	void train_stochastic(const byte_matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws);
+
+	void train_mini_batch(const byte_matrix_view& input, const matrix_view& required_output, int batch_size, int iter_num, float rate, training_workspace& ws);
+
+	std::vector<layer> backpropagation(const matrix_view& input, const matrix_view& required_output);
+
+	void backpropagation(const matrix_view& input, const matrix_view& required_output, float rate);
+
+	// Calculates the gradient into ws.gradient without allocating
+	void backpropagation(const matrix_view& input, const matrix_view& required_output, training_workspace& ws) const;
+
+	void backpropagation(const matrix_view& input, const matrix_view& required_output, float rate, training_workspace& ws);
+
+	void apply_gradient(const training_workspace& ws, float rate);
+
+	// Applies the gradient of a single sample, skipping the weight rows whose input value is zero
+	void apply_sparse_gradient(const training_workspace& ws, float rate);
+
+	void train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate);
+
+	void train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws);
+
+	void train_stochastic(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate);
+
+	void train_stochastic(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate, training_workspace& ws);
 
 	void train_mini_batch(const std::vector<matrix>& input, const std::vector<matrix>& required_output, int iter_num, float rate);
 
+	// Asynchronous SGD without locks (Hogwild!): num_threads threads each take iter_num / num_threads random samples
+	// and apply their updates straight to the shared weights, while the others keep reading and writing them.
+	// The races are deliberate, an update may be computed from slightly stale weights or overwrite a concurrent one.
+	// Only the weight rows whose layer input is nonzero are touched, which keeps collisions rare on sparse data.
+	void train_hogwild(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate, int num_threads);
+
+	void train_mini_batch(const std::vector<matrix>& input, const std::vector<matrix>& required_output, int iter_num, float rate, training_workspace& ws);
+
+	// Every iteration trains on batch_size consecutive rows starting at a random row of the dataset
+	void train_mini_batch(const matrix_view& input, const matrix_view& required_output, int batch_size, int iter_num, float rate, training_workspace& ws);
+
+	// Converts the weights to the given precision, the biases stay floats. 16-bit weights replace the float ones,
+	// which halves the memory of the model and the bandwidth of running it, but training needs fp32 weights.
+	// Model files are saved and loaded with the precision the weights have.
+	void set_weight_precision(weight_precision new_precision);
+
+	weight_precision get_weight_precision() const
+	{
+		return precision;
+	}
+
 	bool save_to_file(const char* const file_name);
 
 	bool load_from_file(const char* const file_name);
 
+	// Maps the model file into memory and uses the weights in place instead of copying them.
+	// Processes mapping the same file share its pages until they write to them, e.g. by training.
+	// Files older than version 3 aren't aligned for that and are loaded with load_from_file.
+	bool map_from_file(const char* const file_name);
+
+	int get_input_size() const
+	{
+		return input_layer_size;
+	}
+
+	int get_output_size() const
+	{
+		return layers.back().size;
+	}
+
+	// Number of layers with weights, the input layer isn't counted
+	int get_num_layers() const
+	{
+		return (int)layers.size();
+	}
+
+	activation get_activation(int layer_index) const
+	{
+		return layers[layer_index].f;
+	}
+
+	int get_layer_size(int layer_index) const
+	{
+		return layers[layer_index].size;
+	}
+
+	// Forward pass of one layer for input.get_height() rows, in the precision of the weights
+	void run_layer(int layer_index, const matrix_view& input, float* output) const;
+
+	// Float weights, empty when they are kept in 16 bits
+	const matrix& get_weights(int layer_index) const
+	{
+		return layers[layer_index].weights;
+	}
+
+	const matrix& get_biases(int layer_index) const
+	{
+		return layers[layer_index].biases;
+	}
+
+	// Copies get_layer_size(layer_index) x prev_layer_size weights, in the layout of get_weights, and get_layer_size(layer_index) biases.
+	// The weights must be fp32.
+	void set_parameters(int layer_index, const float* weights, const float* biases);
+
 	static float calculate_error(matrix values, matrix required_values);
 
 	static float sigmoid(float input)
@@ -79,4 +245,9 @@ public:
 	static matrix activation_function(matrix input);
 
 	static matrix activation_function_derivative(matrix input);
+
+	// In-place friendly versions, input and result may be the same matrix
+	static void activation_function(const matrix& input, matrix& result);
+
+	static void activation_function_derivative(const matrix& input, matrix& result);
 };
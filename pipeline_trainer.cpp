@@ -0,0 +1,270 @@
+#include "pipeline_trainer.h"
+#include "dense_layer.h"
+
+#include <algorithm>
+#include <utility>
+
+pipeline_trainer::pipeline_trainer(neural_net& net, int num_stages, int max_batch_size, int num_micro_batches)
+	: net(net), max_micro_batches(num_micro_batches)
+{
+	assert(num_stages > 0);
+	assert(net.get_weight_precision() == weight_precision::fp32);
+	assert(num_micro_batches > 0);
+	assert(max_batch_size >= num_micro_batches);
+
+	const int num_layers = (int)net.layers.size();
+	num_stages = std::min(num_stages, num_layers);
+	micro_batch_size = (max_batch_size + num_micro_batches - 1) / num_micro_batches;
+
+	// Split the layers into contiguous groups with about the same number of weights
+	auto cost = [&](int l) { return (size_t)net.layers[l].size * net.layers[l].prev_layer_size; };
+
+	size_t total_cost = 0;
+	for (int l = 0; l < num_layers; l++)
+		total_cost += cost(l);
+
+	stages.resize(num_stages);
+
+	int layer = 0;
+	size_t done_cost = 0;
+	for (int s = 0; s < num_stages; s++)
+	{
+		stage& st = stages[s];
+		st.first_layer = layer;
+
+		// Every stage takes at least one layer and leaves one for each of the following stages
+		const int max_layer = num_layers - (num_stages - s - 1);
+		const size_t target_cost = total_cost * (s + 1) / num_stages;
+		do
+		{
+			done_cost += cost(layer);
+			layer++;
+		} while (layer < max_layer && (s == num_stages - 1 || done_cost + cost(layer) / 2 <= target_cost));
+
+		st.last_layer = layer;
+
+		int max_size = net.layers[st.first_layer].prev_layer_size;
+		for (int l = st.first_layer; l < st.last_layer; l++)
+		{
+			st.weights_gradient.emplace_back(net.layers[l].size, net.layers[l].prev_layer_size);
+			st.biases_gradient.emplace_back(net.layers[l].size, 1);
+			max_size = std::max(max_size, net.layers[l].size);
+		}
+
+		st.delta = matrix(max_size, micro_batch_size);
+		st.next_delta = matrix(max_size, micro_batch_size);
+	}
+
+	values.resize(num_micro_batches);
+	input_delta.resize(num_micro_batches);
+	required_output.reserve(num_micro_batches);
+
+	for (int m = 0; m < num_micro_batches; m++)
+	{
+		values[m].reserve(num_layers + 1);
+		values[m].emplace_back(net.input_layer_size, micro_batch_size);
+		for (const neural_net::layer& l : net.layers)
+			values[m].emplace_back(l.size, micro_batch_size);
+
+		input_delta[m].resize(num_stages);
+		for (int s = 1; s < num_stages; s++)
+			input_delta[m][s] = matrix(net.layers[stages[s].first_layer].prev_layer_size, micro_batch_size);
+
+		required_output.emplace_back(net.layers.back().size, micro_batch_size);
+	}
+
+	for (int s = 0; s < num_stages; s++)
+		stages[s].thread = std::thread(&pipeline_trainer::stage_loop, this, s);
+}
+
+pipeline_trainer::~pipeline_trainer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cv.notify_all();
+
+	for (stage& st : stages)
+		st.thread.join();
+}
+
+void pipeline_trainer::stage_loop(int s)
+{
+	const int num_stages = (int)stages.size();
+	stage& st = stages[s];
+	unsigned long long seen_generation = 0;
+
+	for (;;)
+	{
+		int m_count;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&] { return stop || generation != seen_generation; });
+			if (stop) return;
+
+			seen_generation = generation;
+			m_count = num_micro_batches;
+		}
+
+		// Forward, in micro-batch order, as soon as the previous stage hands each one over
+		for (int m = 0; m < m_count; m++)
+		{
+			if (s > 0)
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&] { return stages[s - 1].forward_done > m; });
+			}
+
+			forward(s, m);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				st.forward_done++;
+			}
+			cv.notify_all();
+		}
+
+		// Backward in reverse order, the last stage starts right after its last forward
+		for (int k = 0; k < m_count; k++)
+		{
+			if (s < num_stages - 1)
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&] { return stages[s + 1].backward_done > k; });
+			}
+
+			backward(s, m_count - 1 - k, k > 0);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				st.backward_done++;
+			}
+			cv.notify_all();
+		}
+
+		// No other stage reads this stage's weights any more in this step
+		apply_gradient(s);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stages_finished++;
+		}
+		cv.notify_all();
+	}
+}
+
+void pipeline_trainer::forward(int s, int m)
+{
+	const stage& st = stages[s];
+
+	for (int l = st.first_layer; l < st.last_layer; l++)
+	{
+		const neural_net::layer& layer = net.layers[l];
+		dense_forward(values[m][l], layer.weights, layer.biases, layer.f, values[m][l + 1]);
+	}
+}
+
+void pipeline_trainer::backward(int s, int m, bool accumulate)
+{
+	stage& st = stages[s];
+
+	if (s == (int)stages.size() - 1)
+		st.delta = values[m].back() - required_output[m];
+	else
+		st.delta = input_delta[m][s + 1];
+
+	for (int l = st.last_layer - 1; l >= st.first_layer; l--)
+	{
+		const neural_net::layer& layer = net.layers[l];
+		const int i = l - st.first_layer;
+
+		dense_backward(st.delta, values[m][l + 1], layer.f, st.biases_part); // Activation function and biases partial derivatives
+		multiply(transpose(values[m][l]), st.delta, st.weights_part); // Weights partial derivative
+
+		if (accumulate)
+		{
+			axpby(1.f, st.weights_part, 1.f, st.weights_gradient[i]);
+			axpby(1.f, st.biases_part, 1.f, st.biases_gradient[i]);
+		}
+		else
+		{
+			st.weights_gradient[i] = st.weights_part;
+			st.biases_gradient[i] = st.biases_part;
+		}
+
+		// Neuron connection partial derivative, handed to the previous stage at the stage boundary
+		if (l > st.first_layer)
+		{
+			multiply(st.delta, transpose(layer.weights), st.next_delta);
+			std::swap(st.delta, st.next_delta);
+		}
+		else if (s > 0)
+		{
+			multiply(st.delta, transpose(layer.weights), input_delta[m][s]);
+		}
+	}
+}
+
+void pipeline_trainer::apply_gradient(int s)
+{
+	stage& st = stages[s];
+
+	for (int l = st.first_layer; l < st.last_layer; l++)
+	{
+		neural_net::layer& layer = net.layers[l];
+		const int i = l - st.first_layer;
+
+		axpby(-rate, st.weights_gradient[i], 1.f, layer.weights);
+		axpby(-rate, st.biases_gradient[i], 1.f, layer.biases);
+	}
+}
+
+void pipeline_trainer::step(const matrix_view& input, const matrix_view& required_output, float rate)
+{
+	assert(input.is_alive() && required_output.is_alive());
+	assert(input.get_width() == net.input_layer_size);
+	assert(required_output.get_width() == net.layers.back().size);
+	assert(required_output.get_height() == input.get_height());
+	assert(input.get_height() <= micro_batch_size * max_micro_batches);
+
+	const int rows = input.get_height();
+	const int m_count = (rows + micro_batch_size - 1) / micro_batch_size;
+
+	for (int m = 0; m < m_count; m++)
+	{
+		const int row_a = m * micro_batch_size;
+		const int row_b = std::min(row_a + micro_batch_size, rows);
+		values[m][0] = input.rows(row_a, row_b);
+		this->required_output[m] = required_output.rows(row_a, row_b);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (stage& st : stages)
+		{
+			st.forward_done = 0;
+			st.backward_done = 0;
+		}
+		num_micro_batches = m_count;
+		stages_finished = 0;
+		this->rate = rate;
+		generation++;
+	}
+	cv.notify_all();
+
+	// Batch boundary: every stage has applied its update
+	std::unique_lock<std::mutex> lock(mutex);
+	cv.wait(lock, [&] { return stages_finished == (int)stages.size(); });
+}
+
+void pipeline_trainer::train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate)
+{
+	assert(rate > 0);
+	assert(iter_num > 0);
+
+	for (int i = 0; i < iter_num; i++)
+	{
+		step(input, required_output, rate);
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "neural_net.h"
+
+// Pipeline-parallel training (GPipe): the layers are split into contiguous stages balanced by weight count,
+// each stage runs on its own thread, and every batch is streamed through them as micro-batches.
+// All micro-batches go forward first, then backward in reverse order, so the stages fill up and drain
+// like a pipeline. Gradients are accumulated over the micro-batches and every stage updates its own
+// layers at the batch boundary, which gives the same result as neural_net::train_batch up to float reassociation.
+class pipeline_trainer
+{
+	struct stage
+	{
+		int first_layer = 0; // Layers [first_layer, last_layer)
+		int last_layer = 0;
+		std::thread thread;
+
+		// Number of micro-batches that finished the forward and the backward pass in this step
+		int forward_done = 0;
+		int backward_done = 0;
+
+		// Gradients of the stage's layers accumulated over the micro-batches
+		std::vector<matrix> weights_gradient;
+		std::vector<matrix> biases_gradient;
+
+		matrix delta;
+		matrix next_delta;
+		matrix weights_part;
+		matrix biases_part;
+	};
+
+	neural_net& net;
+	int micro_batch_size;
+	int max_micro_batches;
+	std::vector<stage> stages;
+
+	std::vector<std::vector<matrix>> values; // [micro-batch][layer], values[m][0] is the input
+	std::vector<matrix> required_output; // [micro-batch]
+	std::vector<std::vector<matrix>> input_delta; // [micro-batch][stage], delta of the stage's input for the previous stage
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	unsigned long long generation = 0;
+	int num_micro_batches = 0;
+	int stages_finished = 0;
+	float rate = 0.f;
+	bool stop = false;
+
+	void stage_loop(int s);
+
+	void forward(int s, int m);
+
+	void backward(int s, int m, bool accumulate);
+
+	void apply_gradient(int s);
+
+public:
+	// The batch is split into num_micro_batches micro-batches of at most max_batch_size / num_micro_batches rows
+	pipeline_trainer(neural_net& net, int num_stages, int max_batch_size, int num_micro_batches);
+
+	pipeline_trainer(const pipeline_trainer&) = delete;
+	pipeline_trainer& operator=(const pipeline_trainer&) = delete;
+
+	~pipeline_trainer();
+
+	int get_num_stages() const
+	{
+		return (int)stages.size();
+	}
+
+	// One update over the whole batch
+	void step(const matrix_view& input, const matrix_view& required_output, float rate);
+
+	void train_batch(const matrix_view& input, const matrix_view& required_output, int iter_num, float rate);
+};
@@ -0,0 +1,117 @@
+#include "profiler.h"
+#include "matrix.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <utility>
+
+static bool profiling_from_environment()
+{
+	const char* env = std::getenv("SNN_PROFILE");
+	return env && strcmp(env, "1") == 0;
+}
+
+// Small ids in the order threads first record something, the trace viewer shows a row for each
+static int get_thread_index()
+{
+	static std::atomic<int> next_index{ 0 };
+	thread_local const int index = next_index.fetch_add(1, std::memory_order_relaxed);
+	return index;
+}
+
+std::atomic<bool> profiler::enabled{ profiling_from_environment() };
+
+profiler::profiler() : start_time(clock::now())
+{
+}
+
+profiler& profiler::instance()
+{
+	static profiler p;
+	return p;
+}
+
+void profiler::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	events.clear();
+	start_time = clock::now();
+}
+
+void profiler::record(const char* name, int layer, clock::time_point start, clock::time_point end, double flops, double bytes, size_t allocations)
+{
+	const int thread = get_thread_index();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	events.push_back({ name, layer, thread, start, end, flops, bytes, allocations });
+}
+
+std::vector<profiler::op_stats> profiler::get_stats() const
+{
+	std::map<std::pair<std::string, int>, op_stats> totals;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const event& e : events)
+		{
+			op_stats& s = totals[{ e.name, e.layer }];
+			s.calls++;
+			s.time += std::chrono::duration<double>(e.end - e.start).count();
+			s.flops += e.flops;
+			s.bytes += e.bytes;
+			s.allocations += e.allocations;
+		}
+	}
+
+	std::vector<op_stats> result;
+	result.reserve(totals.size());
+	for (auto& t : totals)
+	{
+		t.second.name = t.first.first;
+		t.second.layer = t.first.second;
+		result.push_back(std::move(t.second));
+	}
+
+	std::sort(result.begin(), result.end(), [](const op_stats& a, const op_stats& b) { return a.time > b.time; });
+	return result;
+}
+
+bool profiler::write_chrome_trace(const char* const file_name) const
+{
+	std::ofstream f(file_name, std::ios::trunc);
+	if (!f.is_open()) return false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Complete events, with timestamps and durations in microseconds
+	f << "{\"traceEvents\":[\n";
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const event& e = events[i];
+		f << "{\"name\":\"" << e.name;
+		if (e.layer >= 0)
+			f << " layer " << e.layer;
+		f << "\",\"cat\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+			<< ",\"ts\":" << std::chrono::duration<double, std::micro>(e.start - start_time).count()
+			<< ",\"dur\":" << std::chrono::duration<double, std::micro>(e.end - e.start).count()
+			<< ",\"args\":{\"layer\":" << e.layer << ",\"flops\":" << e.flops << ",\"bytes\":" << e.bytes
+			<< ",\"allocations\":" << e.allocations << "}}" << (i + 1 < events.size() ? ",\n" : "\n");
+	}
+	f << "],\"displayTimeUnit\":\"ms\"}\n";
+
+	return f.good();
+}
+
+void profile_scope::begin()
+{
+	allocations = matrix::get_allocation_count();
+	start = profiler::clock::now();
+}
+
+void profile_scope::finish()
+{
+	const profiler::clock::time_point end = profiler::clock::now();
+	profiler::instance().record(name, layer, start, end, flops, bytes, matrix::get_allocation_count() - allocations);
+}
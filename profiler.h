@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records scoped timings of the hot paths: forward and backward passes per layer, GEMMs, transposes and the like.
+// Off by default, a disabled scope costs a relaxed atomic load. It is enabled with set_enabled
+// or by the SNN_PROFILE=1 environment variable, and removed at compile time by defining SNN_NO_PROFILING.
+// Nested scopes are recorded separately, the time of a scope includes the scopes inside it.
+class profiler
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	// Totals of one operation, of one layer if it belongs to one
+	struct op_stats
+	{
+		std::string name;
+		int layer = -1; // -1 for operations not tied to a layer
+		size_t calls = 0;
+		double time = 0.; // Seconds
+		double flops = 0.;
+		double bytes = 0.; // Read and written
+		size_t allocations = 0; // Matrix buffers allocated by any thread during the calls
+	};
+
+private:
+	struct event
+	{
+		const char* name;
+		int layer;
+		int thread;
+		clock::time_point start;
+		clock::time_point end;
+		double flops;
+		double bytes;
+		size_t allocations;
+	};
+
+	static std::atomic<bool> enabled;
+	mutable std::mutex mutex;
+	std::vector<event> events;
+	clock::time_point start_time;
+
+	profiler();
+
+public:
+	profiler(const profiler&) = delete;
+	profiler& operator=(const profiler&) = delete;
+
+	static profiler& instance();
+
+	static bool is_enabled()
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	static void set_enabled(bool value)
+	{
+		enabled.store(value, std::memory_order_relaxed);
+	}
+
+	// Forgets the recorded events, trace timestamps restart from zero
+	void reset();
+
+	// name must be a string literal, or live as long as the events
+	void record(const char* name, int layer, clock::time_point start, clock::time_point end, double flops, double bytes, size_t allocations);
+
+	// Totals by operation and layer, the longest first
+	std::vector<op_stats> get_stats() const;
+
+	// Chrome trace event format, for chrome://tracing or https://ui.perfetto.dev
+	bool write_chrome_trace(const char* const file_name) const;
+};
+
+// Records the time from its construction to its destruction, if the profiler was enabled when it was constructed
+class profile_scope
+{
+	const char* name;
+	int layer;
+	double flops;
+	double bytes;
+	size_t allocations = 0;
+	profiler::clock::time_point start;
+	bool active;
+
+public:
+	profile_scope(const char* name, int layer = -1, double flops = 0., double bytes = 0.)
+		: name(name), layer(layer), flops(flops), bytes(bytes), active(profiler::is_enabled())
+	{
+		if (active) begin();
+	}
+
+	profile_scope(const profile_scope&) = delete;
+	profile_scope& operator=(const profile_scope&) = delete;
+
+	~profile_scope()
+	{
+		if (active) finish();
+	}
+
+private:
+	void begin();
+
+	void finish();
+};
+
+#define PROFILE_CONCATENATE_(a, b) a##b
+#define PROFILE_CONCATENATE(a, b) PROFILE_CONCATENATE_(a, b)
+
+// PROFILE_SCOPE(name[, layer[, flops[, bytes]]]) times the rest of the enclosing block.
+// The arguments aren't evaluated when profiling is compiled out, sizeof only keeps them used.
+#ifdef SNN_NO_PROFILING
+#define PROFILE_SCOPE(...) ((void)sizeof(profile_scope(__VA_ARGS__)))
+#else
+#define PROFILE_SCOPE(...) profile_scope PROFILE_CONCATENATE(profile_scope_, __LINE__)(__VA_ARGS__)
+#endif
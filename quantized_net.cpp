@@ -0,0 +1,314 @@
+#include "quantized_net.h"
+#include "auxiliary.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+// Rows run through all layers together, small enough for their int8 and int32 values to stay in cache
+static constexpr int block_rows = 64;
+
+// Rows of int8 values are padded to whole cache lines, which are whole vectors for every kernel
+static int get_stride(int size)
+{
+	return (size + 63) / 64 * 64;
+}
+
+static float symmetric_scale(float max_abs)
+{
+	return max_abs > 0.f ? max_abs / 127.f : 1.f;
+}
+
+static float max_abs(const float* values, size_t count)
+{
+	float result = 0.f;
+	for (size_t i = 0; i < count; i++)
+		result = std::max(result, std::fabs(values[i]));
+	return result;
+}
+
+void quantized_net::layer::update_output_scales()
+{
+	output_scales.resize(size);
+	for (int j = 0; j < size; j++)
+		output_scales[j] = input_scale * weight_scales[j];
+}
+
+quantized_net::quantized_net(const neural_net& net, const matrix_view& calibration_input, quantization_granularity granularity)
+	: input_layer_size(net.get_input_size()), granularity(granularity)
+{
+	assert(net.get_weight_precision() == weight_precision::fp32);
+	assert(calibration_input.get_width() == input_layer_size);
+
+	// values[i] is the input of layer i on the calibration batch
+	const std::vector<matrix> values = net.run_ext_output(calibration_input);
+
+	layers.resize(net.get_num_layers());
+	for (int i = 0; i < net.get_num_layers(); i++)
+	{
+		layer& l = layers[i];
+		const matrix& weights = net.get_weights(i);
+
+		l.size = weights.get_width();
+		l.prev_layer_size = weights.get_height();
+		l.stride = get_stride(l.prev_layer_size);
+		l.f = net.get_activation(i);
+		l.input_scale = symmetric_scale(max_abs(values[i].get_data(), (size_t)values[i].get_width() * values[i].get_height()));
+
+		// Largest weight of every output, and of the whole layer
+		l.weight_scales.assign(l.size, 0.f);
+		for (int k = 0; k < l.prev_layer_size; k++)
+		{
+			for (int j = 0; j < l.size; j++)
+				l.weight_scales[j] = std::max(l.weight_scales[j], std::fabs(weights.at(k, j)));
+		}
+		if (granularity == quantization_granularity::per_layer)
+			l.weight_scales.assign(l.size, *std::max_element(l.weight_scales.begin(), l.weight_scales.end()));
+		for (float& scale : l.weight_scales)
+			scale = symmetric_scale(scale);
+
+		l.weights.assign((size_t)l.size * l.stride, 0);
+		for (int j = 0; j < l.size; j++)
+		{
+			const float inverse_scale = 1.f / l.weight_scales[j];
+			int8_t* row = l.weights.data() + (size_t)j * l.stride;
+			for (int k = 0; k < l.prev_layer_size; k++)
+				row[k] = (int8_t)std::lrint(weights.at(k, j) * inverse_scale);
+		}
+
+		const float* biases = net.get_biases(i).get_data();
+		l.biases.assign(biases, biases + l.size);
+		l.update_output_scales();
+	}
+}
+
+void quantized_net::run_rows(const matrix_view& input, float* output, scratch& s) const
+{
+	const kernel_table& kernel = kernels();
+	const int rows = input.get_height();
+
+	size_t max_stride = 0;
+	size_t max_size = 0;
+	for (const layer& l : layers)
+	{
+		max_stride = std::max(max_stride, (size_t)l.stride);
+		max_size = std::max(max_size, (size_t)l.size);
+	}
+
+	// The padding of the weights is zero, so whatever the padding of values holds adds nothing
+	s.values.resize(rows * max_stride);
+	s.sums.resize(rows * max_size);
+	s.row.resize(max_size);
+
+	for (int r = 0; r < rows; r++)
+		kernel.quantize_s8(input_layer_size, 1.f / layers[0].input_scale, input.row(r), s.values.data() + (size_t)r * layers[0].stride);
+
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		const layer& l = layers[i];
+		const bool last = i + 1 == layers.size();
+
+		kernel.gemm_s8(rows, l.size, l.stride, s.values.data(), l.stride, l.weights.data(), l.stride, s.sums.data(), l.size);
+
+		// The int8 input isn't needed anymore, the quantized output of every row replaces it
+		for (int r = 0; r < rows; r++)
+		{
+			const int32_t* sums = s.sums.data() + (size_t)r * l.size;
+			float* values = last ? output + (size_t)r * l.size : s.row.data();
+
+			for (int j = 0; j < l.size; j++)
+				values[j] = (float)sums[j] * l.output_scales[j] + l.biases[j];
+			kernel.activate(l.f, values, l.size);
+
+			if (!last)
+				kernel.quantize_s8(l.size, 1.f / layers[i + 1].input_scale, values, s.values.data() + (size_t)r * layers[i + 1].stride);
+		}
+	}
+}
+
+matrix quantized_net::run(const matrix_view& input) const
+{
+	assert(input.get_width() == input_layer_size);
+
+	const int rows = input.get_height();
+	matrix result(get_output_size(), rows);
+
+	parallel_for((size_t)rows, block_rows, [&](size_t begin, size_t end)
+	{
+		thread_local scratch s;
+		for (size_t first = begin; first < end; first += block_rows)
+		{
+			const size_t last = std::min(end, first + block_rows);
+			run_rows(input.rows((int)first, (int)last), result.get_data() + first * get_output_size(), s);
+		}
+	});
+
+	return result;
+}
+
+size_t quantized_net::get_parameters_size() const
+{
+	size_t result = 0;
+	for (const layer& l : layers)
+		result += (size_t)l.size * l.prev_layer_size + (l.weight_scales.size() + l.biases.size()) * sizeof(float);
+	return result;
+}
+
+//Quantized model files follow the layout of version 3 files, with every section at a 64 byte boundary,
+//and have int8 weights stored one output per row, without the padding they get in memory
+static constexpr uint32_t quantized_model_magic = 0x002302A8u;
+static constexpr size_t quantized_model_alignment = 64;
+
+struct quantized_model_header
+{
+	uint32_t magic_number;
+	uint8_t little_endian;
+	uint8_t granularity;
+	uint8_t padding[2];
+	int32_t num_layers;
+	int32_t data_offset; // Start of the first layer's weights
+	int32_t reserved[4]; // Zero, for future extensions
+	// Followed by num_layers layer sizes, num_layers - 1 activation functions and num_layers - 1 input scales
+};
+
+static_assert(sizeof(quantized_model_header) == 32, "quantized_model_header must have no padding");
+
+static size_t align_quantized_offset(size_t offset)
+{
+	return (offset + quantized_model_alignment - 1) / quantized_model_alignment * quantized_model_alignment;
+}
+
+static void write_quantized_padding(std::ofstream& f)
+{
+	static const char zeros[quantized_model_alignment] = {};
+	const size_t position = (size_t)f.tellp();
+	f.write(zeros, (std::streamsize)(align_quantized_offset(position) - position));
+}
+
+bool quantized_net::save_to_file(const char* const file_name) const
+{
+	std::ofstream f(file_name, std::ios::binary | std::ios::trunc);
+	if (!f.is_open()) return false;
+
+	const int32_t num_layers = int32_t(layers.size() + 1);
+
+	quantized_model_header header = {};
+	header.magic_number = quantized_model_magic;
+	header.little_endian = is_little_endian();
+	header.granularity = (uint8_t)granularity;
+	header.num_layers = num_layers;
+	header.data_offset = (int32_t)align_quantized_offset(sizeof(quantized_model_header) + 4 * (3 * (size_t)num_layers - 2));
+	write_var(f, header);
+	//Layer sizes, activation functions and scales of the layer inputs
+	write_var(f, (int32_t)input_layer_size);
+	for (const layer& l : layers)
+		write_var(f, (int32_t)l.size);
+	for (const layer& l : layers)
+		write_var(f, (int32_t)l.f);
+	for (const layer& l : layers)
+		write_var(f, l.input_scale);
+	write_quantized_padding(f);
+	//Weights, their scales and biases, each aligned
+	for (const layer& l : layers)
+	{
+		for (int j = 0; j < l.size; j++)
+			f.write(reinterpret_cast<const char*>(l.weights.data()) + (size_t)j * l.stride, l.prev_layer_size);
+		write_quantized_padding(f);
+		f.write(reinterpret_cast<const char*>(l.weight_scales.data()), (std::streamsize)(l.size * sizeof(float)));
+		write_quantized_padding(f);
+		f.write(reinterpret_cast<const char*>(l.biases.data()), (std::streamsize)(l.size * sizeof(float)));
+		write_quantized_padding(f);
+	}
+
+	return f.good();
+}
+
+bool quantized_net::load_from_file(const char* const file_name)
+{
+	binary_data net_data = read_file(file_name);
+	char* data = net_data.get_data();
+	const size_t size = net_data.get_size();
+	if (!data || size < sizeof(quantized_model_header)) return false;
+
+	quantized_model_header header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic_number != quantized_model_magic && header.magic_number != (uint32_t)0xA8022300)
+		return false;
+
+	//If endianness doesn't match, every 4 byte field is swapped as it is read, the int8 weights stay as they are
+	const bool swap = (header.little_endian != 0) != is_little_endian();
+	if (swap)
+	{
+		swap_byte_order(reinterpret_cast<char*>(&header.num_layers), 4);
+		swap_byte_order(reinterpret_cast<char*>(&header.data_offset), 4);
+	}
+
+	const int num_layers = header.num_layers;
+	const size_t data_offset = (size_t)header.data_offset;
+	if (num_layers < 2 || header.granularity > (uint8_t)quantization_granularity::per_channel ||
+		data_offset % quantized_model_alignment != 0 || data_offset > size ||
+		sizeof(quantized_model_header) + 4 * (3 * (size_t)num_layers - 2) > data_offset)
+		return false;
+
+	if (swap)
+	{
+		for (char* i = data + sizeof(quantized_model_header); i < data + sizeof(quantized_model_header) + 4 * (3 * (size_t)num_layers - 2); i += 4)
+			swap_byte_order(i, 4);
+	}
+
+	const int32_t* layer_sizes = reinterpret_cast<const int32_t*>(data + sizeof(quantized_model_header));
+	const int32_t* activations = layer_sizes + num_layers;
+	const float* input_scales = reinterpret_cast<const float*>(activations + num_layers - 1);
+
+	size_t offset = data_offset;
+	auto read_floats = [&](std::vector<float>& destination, int count)
+	{
+		const size_t bytes = count * sizeof(float);
+		if (offset + bytes > size) return false;
+		if (swap)
+		{
+			for (char* i = data + offset; i < data + offset + bytes; i += 4)
+				swap_byte_order(i, 4);
+		}
+		destination.resize(count);
+		memcpy(destination.data(), data + offset, bytes);
+		offset = align_quantized_offset(offset + bytes);
+		return true;
+	};
+
+	std::vector<layer> new_layers(num_layers - 1);
+	for (int i = 1; i < num_layers; i++)
+	{
+		layer& l = new_layers[i - 1];
+		if (layer_sizes[i] <= 0 || layer_sizes[i - 1] <= 0) return false;
+		// Softmax is only supported in the last layer, as in neural_net
+		if (!is_activation(activations[i - 1]) || (activations[i - 1] == (int32_t)activation::softmax && i != num_layers - 1))
+			return false;
+
+		l.size = layer_sizes[i];
+		l.prev_layer_size = layer_sizes[i - 1];
+		l.stride = get_stride(l.prev_layer_size);
+		l.f = (activation)activations[i - 1];
+		l.input_scale = input_scales[i - 1];
+
+		const size_t weights_size = (size_t)l.size * l.prev_layer_size;
+		if (offset + weights_size > size) return false;
+		l.weights.assign((size_t)l.size * l.stride, 0);
+		for (int j = 0; j < l.size; j++)
+			memcpy(l.weights.data() + (size_t)j * l.stride, data + offset + (size_t)j * l.prev_layer_size, l.prev_layer_size);
+		offset = align_quantized_offset(offset + weights_size);
+
+		if (!read_floats(l.weight_scales, l.size) || !read_floats(l.biases, l.size))
+			return false;
+
+		l.update_output_scales();
+	}
+
+	layers = std::move(new_layers);
+	input_layer_size = layer_sizes[0];
+	granularity = (quantization_granularity)header.granularity;
+	return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "neural_net.h"
+
+// How many scales the weights of a layer are quantized with
+enum class quantization_granularity
+{
+	per_layer, per_channel // One for every output neuron
+};
+
+// Inference-only copy of a neural_net with int8 weights, for serving with a quarter of the weight memory and bandwidth.
+// Weights are quantized symmetrically to [-127, 127]. The inputs of every layer are quantized the same way with one scale,
+// calibrated from the largest absolute value the layer sees on a sample batch. A layer multiplies int8 by int8 into
+// int32 sums, then converts them back to floats, adds the biases and applies the activation.
+class quantized_net
+{
+	struct layer
+	{
+		int size = 0;
+		int prev_layer_size = 0;
+		int stride = 0; // prev_layer_size rounded up to whole vectors, the padding is zero
+		activation f = activation::linear;
+		float input_scale = 1.f;
+		std::vector<int8_t> weights; // size rows of stride values, the transpose of the float weights
+		std::vector<float> weight_scales; // One per output, all equal for per_layer
+		std::vector<float> biases;
+		std::vector<float> output_scales; // input_scale * weight_scales, what an int32 sum is multiplied by
+
+		void update_output_scales();
+	};
+
+	// Buffers of one thread running a block of rows
+	struct scratch
+	{
+		std::vector<int8_t> values; // Quantized input of the current layer, rows of the layer's stride
+		std::vector<int32_t> sums;
+		std::vector<float> row; // Float output of a hidden layer for one row, before it is quantized
+	};
+
+	std::vector<layer> layers;
+	int input_layer_size = 0;
+	quantization_granularity granularity = quantization_granularity::per_channel;
+
+	// Runs all layers on a block of rows, output receives input.get_height() x get_output_size() values
+	void run_rows(const matrix_view& input, float* output, scratch& s) const;
+
+public:
+	quantized_net() {}
+
+	// Quantizes the weights of net, the scales of the layer inputs come from running it on calibration_input
+	quantized_net(const neural_net& net, const matrix_view& calibration_input,
+		quantization_granularity granularity = quantization_granularity::per_channel);
+
+	matrix run(const matrix_view& input) const;
+
+	// Own format, with int8 weights and float scales and biases, not readable by neural_net::load_from_file
+	bool save_to_file(const char* const file_name) const;
+
+	bool load_from_file(const char* const file_name);
+
+	int get_input_size() const
+	{
+		return input_layer_size;
+	}
+
+	int get_output_size() const
+	{
+		return layers.back().size;
+	}
+
+	int get_num_layers() const
+	{
+		return (int)layers.size();
+	}
+
+	quantization_granularity get_granularity() const
+	{
+		return granularity;
+	}
+
+	// Bytes of weights, scales and biases
+	size_t get_parameters_size() const;
+};
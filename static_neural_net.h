@@ -0,0 +1,218 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+
+#include "kernels.h"
+#include "neural_net.h"
+
+// Layer of a static_neural_net: Size neurons with the activation function F
+template<int Size, activation F>
+struct static_layer
+{
+	static_assert(Size > 0, "layers need at least one neuron");
+
+	static constexpr int size = Size;
+	static constexpr activation function = F;
+};
+
+// Weights and forward pass of one layer
+template<int InputSize, int Size, activation F>
+struct static_dense
+{
+	// InputSize rows of Size values, the layout of neural_net::get_weights
+	alignas(64) std::array<float, (size_t)InputSize * Size> weights{};
+	alignas(64) std::array<float, Size> biases{};
+
+	// The product goes through the GEMV kernel of the CPU's instruction set, with the bias and activation in its epilogue
+	void run(const float* input, float* output) const
+	{
+		const kernel_table& kernel = kernels();
+
+		gemm_epilogue epilogue;
+		epilogue.bias = biases.data();
+		epilogue.f = F == activation::softmax ? activation::linear : F;
+		kernel.gemv(Size, InputSize, input, weights.data(), Size, output, &epilogue);
+
+		// Softmax is normalized over the whole row
+		if constexpr (F == activation::softmax)
+			kernel.activate(F, output, Size);
+	}
+
+	// Several rows, input_stride values apart, with one GEMM
+	void run(const float* input, size_t input_stride, int rows, float* output) const
+	{
+		gemm_epilogue epilogue;
+		epilogue.bias = biases.data();
+		epilogue.f = F == activation::softmax ? activation::linear : F;
+		gemm(false, false, rows, Size, InputSize, input, input_stride, weights.data(), Size, output, Size, epilogue);
+
+		if constexpr (F == activation::softmax)
+		{
+			for (int i = 0; i < rows; i++)
+				activate(F, output + (size_t)i * Size, Size);
+		}
+	}
+};
+
+// The layers after the input, each one holding the rest
+template<int InputSize, typename... Layers>
+struct static_layer_chain
+{
+	static constexpr int output_size = InputSize;
+	static constexpr int max_size = InputSize;
+};
+
+template<int InputSize, typename Layer, typename... Rest>
+struct static_layer_chain<InputSize, Layer, Rest...>
+{
+	static_dense<InputSize, Layer::size, Layer::function> layer;
+	static_layer_chain<Layer::size, Rest...> rest;
+
+	static constexpr int output_size = static_layer_chain<Layer::size, Rest...>::output_size;
+
+	void run(const float* input, float* output) const
+	{
+		if constexpr (sizeof...(Rest) == 0)
+		{
+			layer.run(input, output);
+		}
+		else
+		{
+			alignas(64) float values[Layer::size];
+			layer.run(input, values);
+			rest.run(values, output);
+		}
+	}
+
+	void run(const float* input, size_t input_stride, int rows, float* output) const
+	{
+		if constexpr (sizeof...(Rest) == 0)
+		{
+			layer.run(input, input_stride, rows, output);
+		}
+		else
+		{
+			matrix values(Layer::size, rows);
+			layer.run(input, input_stride, rows, values.get_data());
+			rest.run(values.get_data(), Layer::size, rows, output);
+		}
+	}
+
+	static void get_topology(int* sizes, activation* activations)
+	{
+		sizes[0] = Layer::size;
+		activations[0] = Layer::function;
+		if constexpr (sizeof...(Rest) > 0)
+			static_layer_chain<Layer::size, Rest...>::get_topology(sizes + 1, activations + 1);
+	}
+
+	void copy_from(const neural_net& net, int layer_index)
+	{
+		const float* weights = net.get_weights(layer_index).get_data();
+		const float* biases = net.get_biases(layer_index).get_data();
+		std::copy(weights, weights + layer.weights.size(), layer.weights.begin());
+		std::copy(biases, biases + layer.biases.size(), layer.biases.begin());
+		if constexpr (sizeof...(Rest) > 0)
+			rest.copy_from(net, layer_index + 1);
+	}
+
+	void copy_to(neural_net& net, int layer_index) const
+	{
+		net.set_parameters(layer_index, layer.weights.data(), layer.biases.data());
+		if constexpr (sizeof...(Rest) > 0)
+			rest.copy_to(net, layer_index + 1);
+	}
+};
+
+// Inference copy of a neural_net whose topology is fixed at compile time, e.g.
+//   static_neural_net<784, static_layer<80, activation::relu>, static_layer<10, activation::softmax>>
+// The weights are arrays inside the object and every layer is sized by constants, so the forward pass allocates nothing,
+// keeps the values between layers on the stack and runs each layer with one call of the GEMV kernel.
+// Large nets are best allocated on the heap, e.g. with std::make_unique, as they hold all their weights.
+// Train a neural_net with the same topology and convert it, or load its model file.
+template<int InputSize, typename... Layers>
+class static_neural_net
+{
+	static_assert(InputSize > 0, "the input layer needs at least one value");
+	static_assert(sizeof...(Layers) > 0, "a network needs at least one layer after the input");
+
+	static_layer_chain<InputSize, Layers...> layers;
+
+public:
+	static constexpr int input_size = InputSize;
+	static constexpr int output_size = static_layer_chain<InputSize, Layers...>::output_size;
+	static constexpr int num_layers = (int)sizeof...(Layers); // The input layer isn't counted
+
+	// Zero weights and biases
+	static_neural_net() {}
+
+	explicit static_neural_net(const neural_net& net)
+	{
+		assert(has_topology(net));
+		layers.copy_from(net, 0);
+	}
+
+	// Whether net has the same layer sizes and activation functions, and fp32 weights to copy
+	static bool has_topology(const neural_net& net)
+	{
+		int sizes[num_layers];
+		activation activations[num_layers];
+		static_layer_chain<InputSize, Layers...>::get_topology(sizes, activations);
+
+		if (net.get_input_size() != InputSize || net.get_num_layers() != num_layers || net.get_weight_precision() != weight_precision::fp32)
+			return false;
+		for (int i = 0; i < num_layers; i++)
+		{
+			if (net.get_layer_size(i) != sizes[i] || net.get_activation(i) != activations[i])
+				return false;
+		}
+		return true;
+	}
+
+	neural_net to_neural_net() const
+	{
+		int sizes[num_layers + 1] = { InputSize };
+		activation activations[num_layers];
+		static_layer_chain<InputSize, Layers...>::get_topology(sizes + 1, activations);
+
+		neural_net net(num_layers + 1, sizes, activations);
+		layers.copy_to(net, 0);
+		return net;
+	}
+
+	// Reads a neural_net model file of any version and precision, it fails if the topology differs
+	bool load_from_file(const char* const file_name)
+	{
+		neural_net net = to_neural_net();
+		if (!net.load_from_file(file_name)) return false;
+
+		net.set_weight_precision(weight_precision::fp32);
+		if (!has_topology(net)) return false;
+
+		layers.copy_from(net, 0);
+		return true;
+	}
+
+	bool save_to_file(const char* const file_name) const
+	{
+		return to_neural_net().save_to_file(file_name);
+	}
+
+	// One row, input holds input_size values and output receives output_size values
+	void run(const float* input, float* output) const
+	{
+		layers.run(input, output);
+	}
+
+	// A batch of rows, every layer multiplies all of them at once like neural_net::run
+	matrix run(const matrix_view& input) const
+	{
+		assert(input.get_width() == InputSize);
+
+		matrix result(output_size, input.get_height());
+		layers.run(input.get_data(), input.get_stride(), input.get_height(), result.get_data());
+		return result;
+	}
+};
@@ -0,0 +1,133 @@
+#include "thread_pool.h"
+#include <cassert>
+#include <cstdlib>
+
+static thread_local bool inside_pool_task = false;
+
+thread_pool::thread_pool()
+{
+	int num_threads = (int)std::thread::hardware_concurrency();
+
+	if (const char* env = std::getenv("SNN_NUM_THREADS"))
+	{
+		const int value = std::atoi(env);
+		if (value > 0) num_threads = value;
+	}
+
+	start(num_threads > 0 ? num_threads : 1);
+}
+
+thread_pool::~thread_pool()
+{
+	shutdown();
+}
+
+thread_pool& thread_pool::instance()
+{
+	static thread_pool pool;
+	return pool;
+}
+
+bool thread_pool::is_worker_thread()
+{
+	return inside_pool_task;
+}
+
+void thread_pool::start(int num_threads)
+{
+	assert(num_threads > 0);
+
+	stop = false;
+	workers.reserve(num_threads - 1);
+	for (int i = 1; i < num_threads; i++)
+		workers.emplace_back(&thread_pool::worker_loop, this);
+}
+
+void thread_pool::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake_cv.notify_all();
+
+	for (std::thread& t : workers)
+		t.join();
+	workers.clear();
+}
+
+void thread_pool::set_num_threads(int num_threads)
+{
+	assert(num_threads > 0);
+	assert(!is_worker_thread());
+
+	std::lock_guard<std::mutex> lock(submit_mutex);
+	if (num_threads == get_num_threads()) return;
+
+	shutdown();
+	start(num_threads);
+}
+
+void thread_pool::drain()
+{
+	const bool was_inside = inside_pool_task;
+	inside_pool_task = true;
+
+	for (int task = next_task.fetch_add(1); task < num_tasks; task = next_task.fetch_add(1))
+		function(context, task);
+
+	inside_pool_task = was_inside;
+}
+
+void thread_pool::worker_loop()
+{
+	unsigned long long seen_generation = 0;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		wake_cv.wait(lock, [&] { return stop || (job_open && generation != seen_generation); });
+		if (stop) return;
+
+		seen_generation = generation;
+		active_workers++;
+		lock.unlock();
+
+		drain();
+
+		lock.lock();
+		if (--active_workers == 0)
+			done_cv.notify_one();
+	}
+}
+
+void thread_pool::run(int num_tasks, task_function function, void* context)
+{
+	std::unique_lock<std::mutex> submit_lock(submit_mutex, std::defer_lock);
+
+	// Tiny jobs, nested calls and calls racing another submitter are executed in place
+	if (num_tasks <= 1 || workers.empty() || inside_pool_task || !submit_lock.try_lock())
+	{
+		for (int task = 0; task < num_tasks; task++)
+			function(context, task);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->function = function;
+		this->context = context;
+		this->num_tasks = num_tasks;
+		next_task.store(0);
+		generation++;
+		job_open = true;
+	}
+	wake_cv.notify_all();
+
+	drain();
+
+	// A worker that picked up the job may still be running its last task
+	std::unique_lock<std::mutex> lock(mutex);
+	job_open = false;
+	done_cv.wait(lock, [&] { return active_workers == 0; });
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <type_traits>
+
+// Process-wide pool of worker threads used by the matrix kernels.
+// The number of threads is taken from the SNN_NUM_THREADS environment variable
+// or from std::thread::hardware_concurrency() and includes the calling thread.
+// Calls made from inside a task, or while another thread owns the pool, run serially on the caller.
+class thread_pool
+{
+	typedef void (*task_function)(void* context, int task);
+
+	std::vector<std::thread> workers;
+	std::mutex submit_mutex;
+	std::mutex mutex;
+	std::condition_variable wake_cv;
+	std::condition_variable done_cv;
+
+	task_function function = nullptr;
+	void* context = nullptr;
+	int num_tasks = 0;
+	std::atomic<int> next_task{ 0 };
+	unsigned long long generation = 0;
+	int active_workers = 0;
+	bool job_open = false;
+	bool stop = false;
+
+	thread_pool();
+
+	void start(int num_threads);
+
+	void shutdown();
+
+	void worker_loop();
+
+	void drain();
+
+	void run(int num_tasks, task_function function, void* context);
+
+public:
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	~thread_pool();
+
+	static thread_pool& instance();
+
+	static bool is_worker_thread();
+
+	int get_num_threads() const
+	{
+		return (int)workers.size() + 1;
+	}
+
+	void set_num_threads(int num_threads);
+
+	// Calls f(task) for every task in [0, num_tasks), spreading the calls over the pool
+	template<typename F>
+	void parallel_for(int num_tasks, F&& f)
+	{
+		typedef std::remove_reference_t<F> function_type;
+		auto invoke = [](void* context, int task) { (*static_cast<function_type*>(context))(task); };
+		run(num_tasks, invoke, const_cast<void*>(static_cast<const void*>(&f)));
+	}
+};
+
+// Minimal number of elements for an element-wise kernel to be split between threads
+constexpr size_t parallel_elementwise_threshold = 1 << 16;
+
+// Splits [0, size) into contiguous ranges of at least grain elements and calls f(begin, end) for each of them
+template<typename F>
+void parallel_for(size_t size, size_t grain, F&& f)
+{
+	thread_pool& pool = thread_pool::instance();
+
+	const size_t max_tasks = grain ? (size + grain - 1) / grain : 1;
+	const int num_tasks = (int)(max_tasks < (size_t)pool.get_num_threads() ? max_tasks : pool.get_num_threads());
+
+	if (num_tasks <= 1)
+	{
+		f((size_t)0, size);
+		return;
+	}
+
+	const size_t chunk = (size + num_tasks - 1) / num_tasks;
+	pool.parallel_for(num_tasks, [&](int task)
+	{
+		const size_t begin = task * chunk;
+		const size_t end = begin + chunk < size ? begin + chunk : size;
+		if (begin < end) f(begin, end);
+	});
+}
+
+// Element-wise loop over [0, size) that only goes parallel for large sizes
+template<typename F>
+void parallel_elementwise(size_t size, F&& f)
+{
+	if (size < parallel_elementwise_threshold)
+	{
+		f((size_t)0, size);
+		return;
+	}
+	parallel_for(size, parallel_elementwise_threshold / 4, f);
+}